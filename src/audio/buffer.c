@@ -1,6 +1,12 @@
-#include <limits.h>
+#ifndef __WIN32
+#define _GNU_SOURCE // memfd_create, MAP_HUGETLB
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <libavutil/mem.h>
 #include <libavutil/samplefmt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,251 +17,659 @@
 #include "audio/seek.h"
 #include "config/settings.h"
 #include "error.h"
+#include "util/log.h"
+
+// Try to allocate buf->data as a mirrored mapping of buf->size bytes.
+// buf->size must be a multiple of the system page size.
+//
+// Returns 0 on success, nonzero if a mirrored mapping couldn't be created.
+static int AudioBuffer_mirror_alloc(AudioBuffer *buf) {
+#ifdef MPL_MIRRORED_BUFFER
+	const int fd = memfd_create("mpl-audiobuffer", MFD_CLOEXEC);
+	if (fd < 0) {
+		return 1;
+	}
+	if (ftruncate(fd, buf->size) != 0) {
+		close(fd);
+		return 1;
+	}
+
+	// Reserve enough address space for both mappings, then map the memfd over each half of it.
+	// (memfd pages start out zeroed, so we don't need to clear them)
+	unsigned char *addr = mmap(NULL, 2 * buf->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		close(fd);
+		return 1;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		void *half = mmap(&addr[i * buf->size], buf->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+		if (half == MAP_FAILED) {
+			munmap(addr, 2 * buf->size);
+			close(fd);
+			return 1;
+		}
+	}
+	// The mappings keep the memfd alive
+	close(fd);
+
+	buf->data = addr;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+// Max # of idle blocks an AudioBufferPool holds on to.
+// At most two tracks have buffers at once, so this is enough for a switch between tracks to allocate nothing.
+#define AUDIOBUFFERPOOL_MAX_IDLE 2
+
+// An AudioBuffer's data, kept in a pool while no buffer is using it
+typedef struct AudioBufferBlock {
+	unsigned char *data;
+	size_t size; // Capacity class of the block: the (power of 2) buffer size it was allocated for
+	bool mirrored;
+	bool locked;
+} AudioBufferBlock;
+
+struct AudioBufferPool {
+	pthread_mutex_t lock;
+	AudioBufferBlock idle[AUDIOBUFFERPOOL_MAX_IDLE];
+	size_t n_idle;
+	size_t max_bytes; // Max # of bytes held by the buffers using the pool and its idle blocks between them, 0 for no limit
+	size_t live_bytes; // # of bytes held by the buffers using the pool
+	size_t idle_bytes; // # of bytes held by idle blocks
+};
+
+// Free a block allocated by AudioBuffer_alloc()
+static void AudioBufferBlock_free(AudioBufferBlock *block) {
+#ifndef __WIN32
+	if (block->mirrored || block->locked) {
+		munmap(block->data, block->mirrored ? 2 * block->size : block->size);
+		block->data = NULL;
+		return;
+	}
+#endif
+	av_freep(&block->data);
+}
+
+AudioBufferPool *AudioBufferPool_new(size_t max_bytes) {
+	AudioBufferPool *pool = calloc(1, sizeof(AudioBufferPool));
+	CHECK_ALLOC(pool, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->max_bytes = max_bytes;
+	return pool;
+}
+
+void AudioBufferPool_free(AudioBufferPool *pool) {
+	if (!pool) {
+		return;
+	}
+	for (size_t i = 0; i < pool->n_idle; i++) {
+		AudioBufferBlock_free(&pool->idle[i]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
 
-int AudioBuffer_init(AudioBuffer *buf, const AudioPCM *pcm, const Settings *settings) {
-	// The number of seconds of track audio we can hold in our buffer
-	const size_t TIME_LEN = 2 * settings->at_buffer_ahead;
+// Take an idle block allocated the same way as *buf (i.e with the same size, mirroring and locking) out of *pool.
+// Returns whether there was one.
+static bool AudioBufferPool_take(AudioBufferPool *pool, const AudioBuffer *buf, AudioBufferBlock *dst) {
+	bool found = false;
+	pthread_mutex_lock(&pool->lock);
+	for (size_t i = 0; i < pool->n_idle; i++) {
+		const AudioBufferBlock *idle = &pool->idle[i];
+		if (idle->size == buf->size && idle->mirrored == buf->mirrored && idle->locked == buf->locked) {
+			*dst = pool->idle[i];
+			// Keep the idle blocks in the order they were put in, oldest first
+			memmove(&pool->idle[i], &pool->idle[i + 1], (pool->n_idle - i - 1) * sizeof(AudioBufferBlock));
+			pool->n_idle--;
+			pool->idle_bytes -= dst->size;
+			pool->live_bytes += dst->size;
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return found;
+}
+
+// Take idle blocks out of *pool, oldest first, until it holds no more than n_idle of them
+// and they fit within its budget along with the live buffers. The blocks taken out are stored in evicted[], to be freed once pool->lock is released.
+// Returns the # of blocks evicted.
+// NOTE: pool->lock must be held
+static size_t AudioBufferPool_trim(AudioBufferPool *pool, size_t n_idle, AudioBufferBlock evicted[AUDIOBUFFERPOOL_MAX_IDLE + 1]) {
+	size_t n_evicted = 0;
+	while (pool->n_idle > 0 && (pool->n_idle > n_idle
+			|| (pool->max_bytes && pool->live_bytes + pool->idle_bytes > pool->max_bytes))) {
+		evicted[n_evicted++] = pool->idle[0];
+		pool->idle_bytes -= pool->idle[0].size;
+		memmove(&pool->idle[0], &pool->idle[1], (pool->n_idle - 1) * sizeof(AudioBufferBlock));
+		pool->n_idle--;
+	}
+	return n_evicted;
+}
 
-	// Compute line and buffer sizes
-	buf->size = av_samples_get_buffer_size(
-			NULL,
-			pcm->n_channels,
-			(pcm->sample_rate * TIME_LEN) + 1, // Add an extra sample for ring buffer alignment
-			pcm->sample_fmt, 0);
+// Count a block of size bytes allocated for a buffer using *pool against the pool's budget,
+// evicting idle blocks that no longer fit within it
+static void AudioBufferPool_count(AudioBufferPool *pool, size_t size) {
+	AudioBufferBlock evicted[AUDIOBUFFERPOOL_MAX_IDLE + 1];
+	pthread_mutex_lock(&pool->lock);
+	pool->live_bytes += size;
+	const size_t n_evicted = AudioBufferPool_trim(pool, AUDIOBUFFERPOOL_MAX_IDLE, evicted);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < n_evicted; i++) {
+		AudioBufferBlock_free(&evicted[i]);
+	}
+}
+
+// Give *block (which was counted against *pool) to *pool, evicting its oldest idle blocks if it's full or over budget.
+// *block itself is freed if it doesn't fit within the budget on its own
+static void AudioBufferPool_put(AudioBufferPool *pool, AudioBufferBlock *block) {
+	AudioBufferBlock evicted[AUDIOBUFFERPOOL_MAX_IDLE + 1];
+	pthread_mutex_lock(&pool->lock);
+	pool->live_bytes -= block->size;
+	const size_t n_evicted = AudioBufferPool_trim(pool, AUDIOBUFFERPOOL_MAX_IDLE - 1, evicted);
+	pool->idle[pool->n_idle++] = *block;
+	pool->idle_bytes += block->size;
+	const size_t n_over = AudioBufferPool_trim(pool, AUDIOBUFFERPOOL_MAX_IDLE, &evicted[n_evicted]);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < n_evicted + n_over; i++) {
+		AudioBufferBlock_free(&evicted[i]);
+	}
+	block->data = NULL;
+}
+
+#ifndef __WIN32
+// Size of the huge pages locked non-mirrored buffers are backed by when the system has them reserved
+#define AUDIOBUFFER_HUGE_PAGE ((size_t)2 << 20)
+
+// Map size bytes of anonymous memory for a locked non-mirrored buffer, backed by huge pages if possible.
+// Returns NULL on failure.
+static unsigned char *AudioBuffer_map_anon(size_t size) {
+	void *addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (size % AUDIOBUFFER_HUGE_PAGE == 0) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (addr == MAP_FAILED) {
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+// Fault in and lock the len bytes at *addr, so reading them never page faults.
+// If they can't be locked (i.e RLIMIT_MEMLOCK is too low), they're only faulted in.
+static void AudioBuffer_lock_pages(unsigned char *addr, size_t len) {
+#ifdef MADV_HUGEPAGE
+	// Transparent huge pages mean fewer TLB misses, and must be asked for before the pages are faulted in
+	madvise(addr, len, MADV_HUGEPAGE);
+#endif
+	// mlock() faults in every page it locks
+	if (mlock(addr, len) == 0) {
+		return;
+	}
+	LOG(Verbosity_VERBOSE, "Warning: failed to lock %zu bytes of AudioBuffer memory (RLIMIT_MEMLOCK may be too low), pre-faulting it instead\n", len);
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < len; i += page_size) {
+		((volatile unsigned char *)addr)[i] = 0;
+	}
+}
+#endif
+
+// Allocate buf->data, mirrored if possible, for a buffer of at least buf->size bytes.
+// buf->size must be a power of 2, and is rounded up to the system page size if the buffer ends up mirrored.
+// If buf->locked is set, buf->data is locked into memory (see AudioBuffer_lock_pages()), and buf->locked is cleared if that isn't supported.
+// Blocks allocated the same way are reused from buf->pool when it has one.
+//
+// Returns 0 on success, nonzero on allocation failure.
+static int AudioBuffer_alloc(AudioBuffer *buf) {
+	AudioBufferBlock block;
+	buf->data = NULL;
+	buf->mirrored = false;
+	buf->straddle = NULL;
+	buf->straddle_reserved = false;
+	buf->straddle_rd = NULL;
+#ifdef __WIN32
+	buf->locked = false;
+#endif
+#ifdef MPL_MIRRORED_BUFFER
+	// Mirrored mappings must be page-aligned (page sizes are powers of 2, so this keeps buf->size a power of 2)
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t size = buf->size;
+	if (buf->size < page_size) {
+		buf->size = page_size;
+	}
+	buf->mirrored = true;
+	if (buf->pool && AudioBufferPool_take(buf->pool, buf, &block)) {
+		buf->data = block.data;
+	} else if (AudioBuffer_mirror_alloc(buf) == 0) {
+		if (buf->locked) {
+			AudioBuffer_lock_pages(buf->data, 2 * buf->size);
+		}
+		if (buf->pool) {
+			AudioBufferPool_count(buf->pool, buf->size);
+		}
+	} else {
+		LOG(Verbosity_VERBOSE, "Warning: failed to create a mirrored AudioBuffer, falling back to a wrapping buffer\n");
+		buf->mirrored = false;
+		buf->size = size;
+	}
+#endif
+	buf->mask = buf->size - 1;
+
+	if (!buf->mirrored) {
+		if (buf->pool && AudioBufferPool_take(buf->pool, buf, &block)) {
+			buf->data = block.data;
+		} else {
+#ifndef __WIN32
+			if (buf->locked) {
+				buf->data = AudioBuffer_map_anon(buf->size);
+				CHECK_ALLOC(buf->data, 1);
+				AudioBuffer_lock_pages(buf->data, buf->size);
+			}
+#endif
+			if (!buf->locked) {
+				// NOTE: this isn't zeroed, since nothing before buf->origin is ever read.
+				// (Pooled blocks hold a previous track's samples for the same reason)
+				buf->data = av_malloc(buf->size);
+				CHECK_ALLOC(buf->data, 1);
+			}
+			if (buf->pool) {
+				AudioBufferPool_count(buf->pool, buf->size);
+			}
+		}
+		// Frames can straddle the end of the buffer when frame_size isn't a power of 2
+		buf->straddle = av_malloc(buf->frame_size);
+		buf->straddle_rd = av_malloc(buf->frame_size);
+		if (!buf->straddle || !buf->straddle_rd) {
+			av_freep(&buf->straddle);
+			av_freep(&buf->straddle_rd);
+			block = (AudioBufferBlock){.data = buf->data, .size = buf->size, .locked = buf->locked};
+			if (buf->pool) {
+				AudioBufferPool_put(buf->pool, &block);
+			} else {
+				AudioBufferBlock_free(&block);
+			}
+			buf->data = NULL;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Round n up to a power of 2
+static size_t pow2_ceil(size_t n) {
+	size_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+int AudioBuffer_init(AudioBuffer *buf, const AudioPCM *pcm, const Settings *settings, uint64_t track_frames, size_t max_size, AudioBufferPool *pool) {
+	buf->pool = pool;
+	buf->locked = settings->at_buffer_lock;
 	buf->frame_size = av_get_bytes_per_sample(pcm->sample_fmt) * pcm->n_channels;
-	//buf->size = buf->frame_size * ((pcm->sample_rate * TIME_LEN) + 1);
+	const size_t byte_rate = buf->frame_size * pcm->sample_rate;
+
+	// Hold the whole track when it fits within at_buffer_whole_mb.
+	// We leave a second of slack since container durations aren't always exact.
+	// NOTE: sizes are rounded up to a power of 2 so positions can be mapped to indices with a mask
+	buf->whole = false;
+	size_t whole_max = (size_t)settings->at_buffer_whole_mb << 20;
+	if (max_size && whole_max > max_size) {
+		whole_max = max_size;
+	}
+	if (track_frames > 0 && track_frames < whole_max / buf->frame_size) {
+		buf->size = pow2_ceil(buf->frame_size * track_frames + byte_rate);
+		if (buf->size <= whole_max) {
+			buf->whole = AudioBuffer_alloc(buf) == 0;
+			if (!buf->whole) {
+				LOG(Verbosity_VERBOSE, "Warning: failed to allocate a whole-track AudioBuffer, falling back to a ring buffer\n");
+			}
+		}
+	}
 
-	// Allocate buffer and set r/w indices
-	// NOTE: we zero this so an accidental read of unintialized data is silent,
-	// instead of loud and often surprising white noise
-	buf->data = av_mallocz(buf->size);
-	CHECK_ALLOC(buf->data, 1);
+	// Otherwise, hold at_buffer_ahead seconds on either side of the read position.
+	// Over max_size, we hold as much as fits (but never less than half a second, so playback can keep up)
+	if (!buf->whole) {
+		buf->size = pow2_ceil(byte_rate * 2 * settings->at_buffer_ahead);
+		const size_t min_size = pow2_ceil(byte_rate / 2);
+		while (max_size && buf->size > max_size && buf->size > min_size) {
+			buf->size >>= 1;
+		}
+		if (max_size && buf->size > max_size) {
+			LOG(Verbosity_VERBOSE, "Warning: AudioBuffer needs %zu bytes, which is over its %zu byte budget\n", buf->size, max_size);
+		}
+		if (AudioBuffer_alloc(buf) != 0) {
+			return 1;
+		}
+	}
+
+	if (buf->whole) {
+		// Decode everything up front. Nothing gets overwritten unless the track turns out to be longer than expected,
+		// in which case we behave like a ring buffer.
+		buf->high_watermark = buf->size / buf->frame_size * buf->frame_size;
+	} else {
+		// Buffer at_buffer_ahead seconds ahead, keeping (at least) half the buffer for past frames to enable bidirectional buffer seeks.
+		// Rounding the size up to a power of 2 only adds room for past frames, not look-ahead
+		buf->high_watermark = byte_rate * settings->at_buffer_ahead;
+		if (buf->high_watermark > buf->size / 2) {
+			buf->high_watermark = buf->size / 2;
+		}
+		buf->high_watermark = buf->high_watermark / buf->frame_size * buf->frame_size;
+	}
+	// Only resume buffering once at_buffer_refill seconds are left ahead
+	buf->low_watermark = byte_rate * settings->at_buffer_refill;
+	if (buf->low_watermark > buf->high_watermark) {
+		buf->low_watermark = buf->high_watermark;
+	}
+
+	buf->origin = 0;
 	buf->rd = 0;
 	buf->wr = 0;
-	buf->n_read = 0;
-	buf->n_written = 0;
+	buf->rd_cached = 0;
+	buf->wr_cached = 0;
 
-	// Initialize semaphores
+	// Initialize wakeups
+	buf->wake_level = SIZE_MAX;
 	sem_init(&buf->rd_sem, 0, 0);
-	sem_init(&buf->wr_sem, 0, 0);
 
 	return 0;
 }
 
 void AudioBuffer_deinit(AudioBuffer *buf) {
-	av_free(buf->data);
+	av_freep(&buf->straddle);
+	av_freep(&buf->straddle_rd);
+	AudioBufferBlock block = {
+		.data = buf->data,
+		.size = buf->size,
+		.mirrored = buf->mirrored,
+		.locked = buf->locked,
+	};
+	if (!block.data) {
+		return;
+	}
+	if (buf->pool) {
+		AudioBufferPool_put(buf->pool, &block);
+	} else {
+		AudioBufferBlock_free(&block);
+	}
 	buf->data = NULL;
 }
 
+// Return the number of bytes that can be written to *buf without blocking.
+// buf->rd is only reloaded when fewer than n bytes look writable using the writer's cached copy of it.
+// NOTE: only the writer may call this
+static inline size_t AudioBuffer_writable(AudioBuffer *buf, const uint64_t wr, const size_t n) {
+	size_t writable = buf->size - (wr - buf->rd_cached);
+	if (writable < n) {
+		buf->rd_cached = atomic_load_explicit(&buf->rd, memory_order_acquire);
+		writable = buf->size - (wr - buf->rd_cached);
+	}
+	return writable;
+}
+
+// Return the number of bytes that can be read from *buf without blocking.
+// buf->wr is only reloaded when fewer than n bytes look readable using the reader's cached copy of it.
+// NOTE: only the reader may call this
+static inline size_t AudioBuffer_readable(AudioBuffer *buf, const uint64_t rd, const size_t n) {
+	size_t readable = buf->wr_cached - rd;
+	if (readable < n) {
+		buf->wr_cached = atomic_load_explicit(&buf->wr, memory_order_acquire);
+		readable = buf->wr_cached - rd;
+	}
+	return readable;
+}
+
+// Copy n bytes from *src into *buf starting at position pos, wrapping around the end of a non-mirrored buffer
+static inline void AudioBuffer_copy_in(AudioBuffer *buf, uint64_t pos, const unsigned char *src, size_t n) {
+	const size_t idx = pos & buf->mask;
+	if (buf->mirrored) {
+		// Writes can run off the end of the first mapping into the second
+		memcpy(&buf->data[idx], src, n);
+		return;
+	}
+	// Write up to the end of the buffer, then wrap around to the start
+	const size_t chunk_size = n < buf->size - idx ? n : buf->size - idx;
+	memcpy(&buf->data[idx], src, chunk_size);
+	memcpy(buf->data, &src[chunk_size], n - chunk_size);
+}
 
 
 size_t AudioBuffer_write(AudioBuffer *buf, unsigned char *src, size_t n) {
-	size_t count = 0; // # of bytes written
+	const uint64_t wr = atomic_load_explicit(&buf->wr, memory_order_relaxed);
 
-	int wr = atomic_load(&buf->wr);
-	const int rd = atomic_load(&buf->rd);
+	const size_t max_write = AudioBuffer_writable(buf, wr, n);
+	const size_t count = n < max_write ? n : max_write; // # of bytes written
+	AudioBuffer_copy_in(buf, wr, src, count);
 
-	while (count < n && (wr+1) % buf->size != rd) {
-		// Write chunk
-		int chunk_size = wr >= rd ? buf->size - wr : (rd-1) - wr;
-		if (chunk_size > n) {
-			chunk_size = n;
-		}
-		if (chunk_size > n-count) {
-			chunk_size = n - count;
+	// Store new wr position
+	atomic_store_explicit(&buf->wr, wr + count, memory_order_release);
+
+	return count;
+}
+
+void AudioBuffer_write_reserve(AudioBuffer *buf, size_t n, unsigned char **ptr, size_t *len) {
+	const uint64_t wr = atomic_load_explicit(&buf->wr, memory_order_relaxed);
+	const size_t idx = wr & buf->mask;
+
+	const size_t max_write = AudioBuffer_writable(buf, wr, n);
+	if (n > max_write) {
+		n = max_write;
+	}
+	n -= n % buf->frame_size;
+
+	buf->straddle_reserved = false;
+	if (!buf->mirrored && n > buf->size - idx) {
+		// Without a mirror, we can only hand out the space up to the end of the buffer
+		n = buf->size - idx;
+		n -= n % buf->frame_size;
+		if (n == 0) {
+			// The next frame straddles the end of the buffer. Hand out scratch space for it,
+			// which AudioBuffer_write_commit() will copy in.
+			*ptr = buf->straddle;
+			*len = buf->frame_size;
+			buf->straddle_reserved = true;
+			return;
 		}
-		memcpy(&buf->data[wr], &src[count], chunk_size);
+	}
+
+	*ptr = &buf->data[idx];
+	*len = n;
+}
 
-		// Increment write idx and count
-		wr += chunk_size;
-		wr %= buf->size;
-		count += chunk_size;
+void AudioBuffer_write_commit(AudioBuffer *buf, size_t len) {
+	const uint64_t wr = atomic_load_explicit(&buf->wr, memory_order_relaxed);
+
+	if (buf->straddle_reserved) {
+		AudioBuffer_copy_in(buf, wr, buf->straddle, len);
+		buf->straddle_reserved = false;
 	}
 
-	// Store new wr index
-	atomic_store(&buf->wr, wr);
-	// Notify any parties waiting on a write
-	sem_post(&buf->wr_sem);
-	// Increment cumulative bytes written
-	buf->n_written += count;
+	// Store new wr position
+	atomic_store_explicit(&buf->wr, wr + len, memory_order_release);
+}
 
-	return count;
+void AudioBuffer_write_reserve_at(AudioBuffer *buf, uint64_t pos, size_t n, unsigned char **ptr, size_t *len) {
+	const size_t idx = pos & buf->mask;
+
+	n -= n % buf->frame_size;
+	if (!buf->mirrored && n > buf->size - idx) {
+		// Without a mirror, we can only hand out the space up to the end of the buffer
+		n = buf->size - idx;
+		n -= n % buf->frame_size;
+	}
+
+	*ptr = &buf->data[idx];
+	*len = n;
+}
+
+void AudioBuffer_write_at(AudioBuffer *buf, uint64_t pos, const unsigned char *src, size_t n) {
+	AudioBuffer_copy_in(buf, pos, src, n);
 }
 
 
 size_t AudioBuffer_read(AudioBuffer *buf, unsigned char *dst, size_t n, bool align) {
-	size_t count = 0; // # of bytes read
+	AudioBufferRegion regions[AUDIOBUFFER_N_REGIONS];
+	const size_t count = AudioBuffer_read_peek(buf, n, align, regions); // # of bytes read
+
+	size_t copied = 0;
+	for (size_t i = 0; i < AUDIOBUFFER_N_REGIONS; i++) {
+		if (regions[i].len > 0) {
+			memcpy(&dst[copied], regions[i].data, regions[i].len);
+			copied += regions[i].len;
+		}
+	}
+	AudioBuffer_read_consume(buf, count);
 
-	const int wr = atomic_load(&buf->wr);
-	int rd = atomic_load(&buf->rd);
+	return count;
+}
+
+size_t AudioBuffer_read_peek(AudioBuffer *buf, size_t n, bool align, AudioBufferRegion regions[AUDIOBUFFER_N_REGIONS]) {
+	const uint64_t rd = atomic_load_explicit(&buf->rd, memory_order_relaxed);
+	const size_t idx = rd & buf->mask;
 
+	size_t max_read = AudioBuffer_readable(buf, rd, n);
 	if (align) {
-		const size_t max_read = AudioBuffer_max_read(buf, rd, wr, align);
-		if (max_read < n) {
-			n = max_read;
-		}
+		max_read -= max_read % buf->frame_size;
+	}
+	if (n > max_read) {
+		n = max_read;
 	}
 
-	while (count < n && rd != wr) {
-		// Read chunk
-		int chunk_size = rd < wr ? wr - rd : buf->size - rd;
-		if (chunk_size > n) {
-			chunk_size = n;
-		}
-		if (chunk_size > n - count) {
-			chunk_size = n - count;
-		}
-		memcpy(&dst[count], &buf->data[rd], chunk_size);
-
-		// Increment read idx and count
-		rd += chunk_size;
-		rd %= buf->size;
-		count += chunk_size;
+	regions[0].data = &buf->data[idx];
+	regions[1].data = buf->straddle_rd;
+	regions[1].len = 0;
+	regions[2].data = buf->data;
+	regions[2].len = 0;
+	if (buf->mirrored || n <= buf->size - idx) {
+		// Reads from a mirrored buffer can run off the end of the first mapping into the second
+		regions[0].len = n;
+		return n;
 	}
 
-	// Store new rd index
-	atomic_store(&buf->rd, rd);
-	// Notify any parties waiting on a read
-	sem_post(&buf->rd_sem);
-	// Increment cumulative bytes read
-	buf->n_read += count;
+	// Read the whole frames up to the end of the buffer, then wrap around to the start.
+	// A frame straddling the end (when frame_size isn't a power of 2) is copied out whole, so no region splits a frame
+	const size_t tail = buf->size - idx;
+	regions[0].len = tail - tail % buf->frame_size;
+	if (regions[0].len < tail) {
+		const size_t split = tail - regions[0].len; // # of the straddling frame's bytes before the end of the buffer
+		memcpy(buf->straddle_rd, &buf->data[idx + regions[0].len], split);
+		memcpy(&buf->straddle_rd[split], buf->data, buf->frame_size - split);
+		regions[1].len = n - regions[0].len < buf->frame_size ? n - regions[0].len : buf->frame_size;
+		regions[2].data = &buf->data[buf->frame_size - split];
+	}
+	regions[2].len = n - regions[0].len - regions[1].len;
 
-	return count;
+	return n;
 }
 
-const size_t AudioBuffer_max_read(const AudioBuffer *buf, int rd, int wr, bool align) {
-	// Load rd/wr directly if not provided
-	if (rd < 0 || wr < 0) {
-		rd = atomic_load(&buf->rd);
-		wr = atomic_load(&buf->wr);
+void AudioBuffer_read_consume(AudioBuffer *buf, size_t n) {
+	// Store new rd position
+	const uint64_t rd = atomic_load_explicit(&buf->rd, memory_order_relaxed) + n;
+	// NOTE: this pairs with the store to wake_level in AudioBuffer_wait_drain(),
+	// so the rd store must not be reordered after our wake_level load
+	atomic_store_explicit(&buf->rd, rd, memory_order_seq_cst);
+
+	// Wake the writer only once we've drained to the level it's waiting for
+	const size_t wake_level = atomic_load_explicit(&buf->wake_level, memory_order_seq_cst);
+	if (wake_level != SIZE_MAX && atomic_load_explicit(&buf->wr, memory_order_acquire) - rd <= wake_level) {
+		// Only one reader can claim the wakeup
+		if (atomic_exchange(&buf->wake_level, SIZE_MAX) != SIZE_MAX) {
+			sem_post(&buf->rd_sem);
+		}
 	}
+}
 
-	size_t maxrd;
-	if (wr >= rd) {
-		maxrd = wr - rd;
-	} else {
-		maxrd = buf->size - (rd - wr);
+void AudioBuffer_wait_drain(AudioBuffer *buf, size_t level) {
+	const uint64_t wr = atomic_load_explicit(&buf->wr, memory_order_relaxed);
+
+	// Publish our wake level before checking the fill level, so the reader can't miss it
+	atomic_store_explicit(&buf->wake_level, level, memory_order_seq_cst);
+	if (wr - atomic_load_explicit(&buf->rd, memory_order_seq_cst) > level) {
+		sem_wait(&buf->rd_sem);
 	}
+	atomic_store(&buf->wake_level, SIZE_MAX);
+}
+
+void AudioBuffer_wake(AudioBuffer *buf) {
+	sem_post(&buf->rd_sem);
+}
 
+const size_t AudioBuffer_max_read(const AudioBuffer *buf, bool align) {
+	const uint64_t rd = atomic_load(&buf->rd);
+	const uint64_t wr = atomic_load(&buf->wr);
+
+	size_t maxrd = wr - rd;
 	if (align) {
 		maxrd -= (maxrd % buf->frame_size);
 	}
-	
+
 	return maxrd;
 }
 
-// Try to seek n bytes backwards in an AudioBuffer
-static enum AudioBuffer_ERR AudioBuffer_seek_backward(AudioBuffer *buf, int n, enum AudioSeek from,
-		int rd, const int wr);
-// Try to seek n bytes forwards in an AudioBuffer
-static enum AudioBuffer_ERR AudioBuffer_seek_forward(AudioBuffer *buf, int n, enum AudioSeek from,
-		int rd, const int wr);
-
-// WIP
 enum AudioBuffer_ERR AudioBuffer_seek(AudioBuffer *buf, int64_t offset_bytes, enum AudioSeek from) {
-
-	// For now, support only relative seeks
-	if (from != AudioSeek_Relative) {
-		fprintf(stderr, "Only relative seeks are currently supported\n");
+	const uint64_t rd = atomic_load(&buf->rd);
+	const uint64_t wr = atomic_load(&buf->wr);
+
+	// Resolve the seek's target position
+	int64_t target;
+	switch (from) {
+	case AudioSeek_Start:
+		target = offset_bytes;
+		break;
+	case AudioSeek_Relative:
+		target = rd + offset_bytes;
+		break;
+	case AudioSeek_End:
+		target = wr + offset_bytes;
+		break;
+	default:
 		return AudioBuffer_INVALID_SEEK;
 	}
 
 	// Check if our seek is within valid data bounds
-	if (offset_bytes == 0) {
+	if (target == rd) {
 		// Handle a zero seek as a noop
 		return AudioBuffer_OK;
 	}
-	// TODO: how likely are we to actually exceed INT_MAX
-	if (offset_bytes > INT_MAX || offset_bytes < INT_MIN) {
-		return AudioBuffer_SEEK_OOB;
-	}
 
-	const int rd = atomic_load(&buf->rd);
-	const int wr = atomic_load(&buf->wr);
-	if (rd == wr) {
-		// Can't seek in an empty buffer
-		return AudioBuffer_SEEK_OOB;
+	// Everything in [history, wr) is still held in the buffer.
+	// Anything before history has been overwritten (or was never written to begin with).
+	uint64_t history = wr > buf->size ? wr - buf->size : 0;
+	if (history < buf->origin) {
+		history = buf->origin;
 	}
 
-	if (offset_bytes < 0) {
-		return AudioBuffer_seek_backward(buf, -offset_bytes, from, rd, wr);
-	}
-	return AudioBuffer_seek_forward(buf, offset_bytes, from, rd, wr);
-}
-
-static enum AudioBuffer_ERR AudioBuffer_seek_backward(AudioBuffer *buf, int n, enum AudioSeek from,
-		int rd, int wr) {
-	// Sanity check n
-	if (n >= buf->size || n < 0) {
-		return AudioBuffer_SEEK_OOB;
-	}
-
-	// Whether our seek can wrap around the buffer
-	const bool wrap = rd < wr && buf->n_written >= buf->size;
-
-	// Handle non-wrapping seeks (these are easy)
-	if (!wrap) {
-		const int s_max = wr < rd ? (rd - (wr+1)) : rd; // inclusive seek limit
+	if (target < (int64_t)history) {
 		// Don't block seeks to track start
-		if (buf->n_written < buf->size && n > s_max) {
-			n = s_max;
-		}
-		if (n > s_max) {
+		if (history > 0) {
 			return AudioBuffer_SEEK_OOB;
 		}
-		rd -= n;
-		buf->n_read -= n;
-		atomic_store(&buf->rd, rd);
-		return AudioBuffer_OK;
-	}
-
-	// Handle wrapping seeks
-	const int size = buf->size;
-	const int s_max = size - ((wr+1) - rd);
-	if (n > s_max) {
+		target = 0;
+	} else if (target >= (int64_t)wr) {
+		// Can't seek to or past the end of what's been buffered
 		return AudioBuffer_SEEK_OOB;
 	}
-	rd -= n;
-	if (rd < 0) {
-		// take rd %= n using arithmetic mod.
-		rd = size + rd; // e.g (0 - 1 % 10 -> 9)
-	}
-	atomic_store(&buf->rd, rd);
-	buf->n_read -= n;
+
+	atomic_store(&buf->rd, target);
+	// Both sides are locked, so we can safely refresh their cached positions
+	buf->rd_cached = target;
+	buf->wr_cached = wr;
 	return AudioBuffer_OK;
 }
 
-static enum AudioBuffer_ERR AudioBuffer_seek_forward(AudioBuffer *buf, int n, enum AudioSeek from,
-	int rd, const int wr) {
-	// Sanity check n
-	if (n >= buf->size || n < 0) {
-		return AudioBuffer_SEEK_OOB;
-	}
-
-	// Whether our seek can wrap around the buffer
-	const bool wrap = wr < rd;
-
-	// Handle non-wrapping seeks
-	if (!wrap) {
-		const int s_max = (wr-1) - rd;
-		if (n > s_max) {
-			return AudioBuffer_SEEK_OOB;
-		}
-		rd += n;
-		buf->n_read += n;
-		atomic_store(&buf->rd, rd);
-		return AudioBuffer_OK;
-	}
-
-	// Handle wrapping seeks
-	const int size = buf->size;
-	const int s_max = size - (rd - (wr-1));
-	if (n > s_max) {
-		return AudioBuffer_SEEK_OOB;
-	}
-	rd += n;
-	rd %= buf->size;
-	buf->n_read += n;
-	atomic_store(&buf->rd, rd);
-	return AudioBuffer_OK;
+void AudioBuffer_reset(AudioBuffer *buf, uint64_t pos) {
+	buf->origin = pos;
+	atomic_store(&buf->rd, pos);
+	atomic_store(&buf->wr, pos);
+	// Both sides are locked, so we can safely reset their cached positions
+	buf->rd_cached = pos;
+	buf->wr_cached = pos;
+	buf->straddle_reserved = false;
 }
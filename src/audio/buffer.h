@@ -12,43 +12,175 @@
 #include <semaphore.h>
 
 
-// A ring buffer used to hold decoded PCM samples
+// Assumed size of a CPU cache line, used to keep writer and reader state from sharing one
+#define AUDIOBUFFER_CACHE_LINE 64
+
+// A pool of AudioBuffer data blocks, recycled between the tracks that own buffers over time
+typedef struct AudioBufferPool AudioBufferPool;
+
+// A ring buffer used to hold decoded PCM samples.
+// Fields are grouped by which side touches them and padded apart, so the writer (BufferThread)
+// and reader (AudioBackend) never write to a cache line the other is reading.
 struct RingBuffer {
-	size_t size; // Total size of the buffer in bytes
+	/* Shared: read-only after initialization */
+	size_t size; // Total size of the buffer in bytes. Always a power of 2
+	size_t mask; // size - 1, used to map a read/write position to its index in *data
 	size_t frame_size; // Frame size, for convenient computation of the number of frames read
 
 	unsigned char *data;
-	atomic_int rd, wr; // Read/write indices relative to line_size
-	size_t n_read; // Cumulative number of bytes read since initialization
-	size_t n_written; // Cumulative number of bytes written since initialization
+	// Whether *data is mirrored: the same pages are mapped twice, back to back,
+	// so any read or write of up to size bytes starting at data[i] (i < size) is one contiguous region.
+	bool mirrored;
+	// Whether *data is locked into memory for real-time use: pre-faulted, mlock()ed if RLIMIT_MEMLOCK allows,
+	// and backed by huge pages where the system provides them
+	bool locked;
+	// Whether the buffer is big enough to hold the whole track, in which case the BufferThread decodes all of it
+	// and every seek within the track can be done in-buffer
+	bool whole;
+	// Pool *data is returned to on deinitialization, or NULL
+	AudioBufferPool *pool;
+
+	// Buffering watermarks, in bytes of data left to read (always multiples of frame_size).
+	// The writer fills *data up to high_watermark, then sleeps until it drains to low_watermark.
+	size_t high_watermark;
+	size_t low_watermark;
+
+	// Position of the first byte written since the buffer was last reset (see AudioBuffer_reset()).
+	// Nothing before it can be seeked to in-buffer.
+	uint64_t origin;
+
+	unsigned char pad_shared_[AUDIOBUFFER_CACHE_LINE];
+
+	/* Writer state */
+	// Write position: the cumulative number of bytes written since initialization (adjusted by seeks).
+	// This never wraps around; its index in *data is (wr & mask).
+	_Atomic uint64_t wr;
+	// The writer's copy of rd, only reloaded when the buffer looks full
+	uint64_t rd_cached;
+	// Single-frame scratch space handed out by AudioBuffer_write_reserve() when a frame would straddle the end of a non-mirrored buffer.
+	// NULL if the buffer is mirrored.
+	unsigned char *straddle;
+	bool straddle_reserved;
+
+	unsigned char pad_wr_[AUDIOBUFFER_CACHE_LINE];
+
+	/* Reader state */
+	// Read position: the cumulative number of bytes read since initialization (adjusted by seeks).
+	// This never wraps around; its index in *data is (rd & mask).
+	_Atomic uint64_t rd;
+	// The reader's copy of wr, only reloaded when the buffer looks empty
+	uint64_t wr_cached;
+	// Single-frame scratch space exposed by AudioBuffer_read_peek() when a frame straddles the end of a non-mirrored buffer.
+	// NULL if the buffer is mirrored.
+	unsigned char *straddle_rd;
+	// Fill level (in bytes left to read) at which a writer sleeping in AudioBuffer_wait_drain() should be woken.
+	// SIZE_MAX when no writer is sleeping. Kept with the reader state since the reader checks it on every read.
+	_Atomic size_t wake_level;
 
-	// Semaphores providing read/write notifications to minimize spinning
-	sem_t rd_sem, wr_sem;
+	unsigned char pad_rd_[AUDIOBUFFER_CACHE_LINE];
+
+	// Semaphore a writer sleeps on in AudioBuffer_wait_drain().
+	// Only posted when the fill level crosses wake_level, not on every read.
+	sem_t rd_sem;
 };
 typedef struct RingBuffer AudioBuffer;
 
-// Initialize an AudioBuffer for use
-int AudioBuffer_init(AudioBuffer *buf, const AudioPCM *pcm, const Settings *settings);
+// A contiguous region of readable data in an AudioBuffer, exposed by AudioBuffer_read_peek()
+typedef struct AudioBufferRegion {
+	unsigned char *data;
+	size_t len; // Region size in bytes
+} AudioBufferRegion;
+// Max # of regions AudioBuffer_read_peek() splits a read into
+#define AUDIOBUFFER_N_REGIONS 3
+
+// Initialize an AudioBuffer for use with a track track_frames sample frames long (0 if unknown).
+// The buffer holds the whole track if it fits within settings->at_buffer_whole_mb, and is a ring buffer otherwise.
+// Its size is kept within max_size bytes (0 for no limit), shrinking the ring to fewer seconds of audio if needed.
+// When MPL is built with MPL_MIRRORED_BUFFER, buf->data is mirrored if the system allows it.
+// buf->data is locked into memory if settings->at_buffer_lock is set.
+// If *pool isn't NULL, buf->data is taken from it when it holds a block of the right size, and returned to it by AudioBuffer_deinit().
+int AudioBuffer_init(AudioBuffer *buf, const AudioPCM *pcm, const Settings *settings, uint64_t track_frames, size_t max_size, AudioBufferPool *pool);
 // Deinitialize an AudioBuffer for freeing
 void AudioBuffer_deinit(AudioBuffer *buf);
 
+// Create an empty AudioBufferPool. Idle blocks are only kept while they fit within max_bytes (0 for no limit)
+// along with the blocks of every AudioBuffer using the pool. Returns NULL on allocation failure.
+AudioBufferPool *AudioBufferPool_new(size_t max_bytes);
+// Free an AudioBufferPool along with every block it holds.
+// NOTE: every AudioBuffer using *pool must be deinitialized first
+void AudioBufferPool_free(AudioBufferPool *pool);
+
 // Write up to n bytes from *src to *ab. Never blocks.
 // Returns the number of bytes actually written.
 size_t AudioBuffer_write(AudioBuffer *buf, unsigned char *src, size_t n);
+// Reserve up to n bytes of contiguous space at the write end of *buf, so the caller can write into it directly. Never blocks.
+// Sets *ptr to the start of the reserved space and *len to its size in bytes.
+// *len is always a multiple of buf->frame_size, and is 0 when the buffer is full.
+//
+// Nothing written to the reserved space is visible to readers until AudioBuffer_write_commit() is called.
+void AudioBuffer_write_reserve(AudioBuffer *buf, size_t n, unsigned char **ptr, size_t *len);
+// Commit len bytes written to the space returned by the last AudioBuffer_write_reserve() call
+// (or with AudioBuffer_write_at() from the write position on), making them visible to readers.
+// WARN: len must not exceed the reserved/written length.
+void AudioBuffer_write_commit(AudioBuffer *buf, size_t len);
+// Reserve up to n bytes of contiguous space at position pos, ahead of the write position, so the caller can write into it directly
+// without committing it. Like AudioBuffer_write_at(), this lets several threads fill disjoint ranges of the free space at once.
+// Sets *ptr to the start of the reserved space and *len to its size in bytes, which is always a multiple of buf->frame_size.
+// *len is 0 when the frame at pos straddles the end of a non-mirrored buffer, in which case it has to be copied in with AudioBuffer_write_at().
+// WARN: [pos, pos + n) must lie within the free space, i.e between the write position and (read position + buf->size)
+void AudioBuffer_write_reserve_at(AudioBuffer *buf, uint64_t pos, size_t n, unsigned char **ptr, size_t *len);
+// Copy n bytes from *src into *buf at position pos, ahead of the write position, without committing them.
+// This lets several threads fill disjoint ranges of the free space at once, to be committed in order by the writer.
+// WARN: [pos, pos + n) must lie within the free space, i.e between the write position and (read position + buf->size)
+void AudioBuffer_write_at(AudioBuffer *buf, uint64_t pos, const unsigned char *src, size_t n);
 // Read up to n bytes from *ab to *dst. Never blocks.
 // Returns the number of bytes actually read.
 //
 // Iff align == 1 and the n parameter is a multiple of buf->frame_size,
 // the returned number of bytes is guaranteed to also be a multiple of buf->frame_size.
 size_t AudioBuffer_read(AudioBuffer *buf, unsigned char *dst, size_t n, bool align);
+// Expose up to n readable bytes of *buf without copying them (mostly). Never blocks.
+// The bytes are split into regions, in order, any of which may be empty:
+// regions[0] is the data up to the end of the buffer, regions[2] the data that wraps around to its start,
+// and regions[1] a copy of the frame straddling the end of the buffer, if there is one.
+// So when reading whole frames, each region holds whole frames. regions[1] and regions[2] are always empty for a mirrored buffer.
+//
+// Nothing is removed from the buffer until AudioBuffer_read_consume() is called.
+// Alignment works the same as for AudioBuffer_read().
+// Returns the total number of bytes exposed.
+size_t AudioBuffer_read_peek(AudioBuffer *buf, size_t n, bool align, AudioBufferRegion regions[AUDIOBUFFER_N_REGIONS]);
+// Consume n bytes exposed by the last AudioBuffer_read_peek() call, freeing them up for writing.
+// WARN: n must not exceed the number of bytes exposed.
+void AudioBuffer_read_consume(AudioBuffer *buf, size_t n);
 // Return the maximum size (in bytes) of a non-blocking read, optionally aligned to buf->frame_size
-// NOTE: Pass -1 as rd and wr to automatically load rd/wr indices
-const size_t AudioBuffer_max_read(const AudioBuffer *buf, int rd, int wr, bool align);
+const size_t AudioBuffer_max_read(const AudioBuffer *buf, bool align);
+
+// Sleep until at most level bytes are left to read in *buf, so the caller can refill it in one burst.
+// May return early (i.e when woken by AudioBuffer_wake()), so callers should re-check the fill level.
+// NOTE: only the writer may call this
+void AudioBuffer_wait_drain(AudioBuffer *buf, size_t level);
+// Wake a writer sleeping in AudioBuffer_wait_drain(), regardless of the fill level
+void AudioBuffer_wake(AudioBuffer *buf);
+
+// Return the cumulative number of bytes read from *buf
+static inline uint64_t AudioBuffer_n_read(const AudioBuffer *buf) {
+	return atomic_load(&buf->rd);
+}
+// Return the cumulative number of bytes written to *buf
+static inline uint64_t AudioBuffer_n_written(const AudioBuffer *buf) {
+	return atomic_load(&buf->wr);
+}
 
 // Try to seek within an AudioBuffer.
+// AudioSeek_Start seeks to an absolute read position, AudioSeek_Relative seeks relative to the current read position,
+// and AudioSeek_End seeks relative to the write position (i.e the end of what's been buffered).
 // NOTE: the buffer must be de-facto locked via some external mechanism when this is called.
 // The ideal way to achieve this is to lock the AudioBackend thread and have the BufferThread
 // handle seeks.
 //
-// Returns 0 on success, or -1 when the seek cannot be done in-buffer.
+// Returns AudioBuffer_OK on success, or AudioBuffer_SEEK_OOB when the seek cannot be done in-buffer.
 enum AudioBuffer_ERR AudioBuffer_seek(AudioBuffer *buf, int64_t offset_bytes, enum AudioSeek seek_dir);
+// Drop everything held in *buf and restart reading and writing at position pos (in bytes),
+// i.e after the track feeding it was seeked to pos.
+// NOTE: the buffer must be locked the same way as for AudioBuffer_seek()
+void AudioBuffer_reset(AudioBuffer *buf, uint64_t pos);
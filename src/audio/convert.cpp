@@ -0,0 +1,155 @@
+extern "C" {
+#include "convert.h"
+
+#include <libavutil/samplefmt.h>
+#include <math.h>
+#include <string.h>
+}
+
+#include <type_traits>
+
+// Load a sample from possibly unaligned memory
+template <typename T>
+static inline T load(const unsigned char *src) {
+	T sample;
+	memcpy(&sample, src, sizeof(T));
+	return sample;
+}
+// Store a sample to possibly unaligned memory
+template <typename T>
+static inline void store(unsigned char *dst, T sample) {
+	memcpy(dst, &sample, sizeof(T));
+}
+
+// Sample conversions, following libswresample's scaling conventions.
+// Integer formats are scaled so their full range maps to [-1.0, 1.0), and floats outside that range are clipped.
+template <typename Dst, typename Src>
+struct Convert;
+
+template <typename T>
+struct Convert<T, T> {
+	static inline T sample(T s) { return s; }
+};
+template <>
+struct Convert<int32_t, int16_t> {
+	static inline int32_t sample(int16_t s) { return (int32_t)s * (1 << 16); }
+};
+template <>
+struct Convert<float, int16_t> {
+	static inline float sample(int16_t s) { return s * (1.0f / (1 << 15)); }
+};
+template <>
+struct Convert<int16_t, int32_t> {
+	static inline int16_t sample(int32_t s) { return s >> 16; }
+};
+template <>
+struct Convert<float, int32_t> {
+	static inline float sample(int32_t s) { return s * (1.0f / (1u << 31)); }
+};
+template <>
+struct Convert<int16_t, float> {
+	static inline int16_t sample(float s) {
+		const float v = s * (1 << 15);
+		return v <= INT16_MIN ? INT16_MIN : v >= INT16_MAX ? INT16_MAX : (int16_t)lrintf(v);
+	}
+};
+template <>
+struct Convert<int32_t, float> {
+	static inline int32_t sample(float s) {
+		// Scaled in double precision, since a float can't represent INT32_MAX
+		const double v = s * (double)(1u << 31);
+		return v <= INT32_MIN ? INT32_MIN : v >= INT32_MAX ? INT32_MAX : (int32_t)lrint(v);
+	}
+};
+
+// Convert frames of Src samples into interleaved frames of Dst samples.
+// N is the channel count, or 0 to use n_channels at runtime.
+template <typename Dst, typename Src, bool planar, uint8_t N>
+static void convert_frames(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples, uint8_t n_channels) {
+	const size_t n_ch = N ? N : n_channels;
+	if (!planar) {
+		const unsigned char *in = &src[0][offset * n_ch * sizeof(Src)];
+		if (std::is_same<Src, Dst>::value) {
+			memcpy(dst, in, n_samples * n_ch * sizeof(Src));
+			return;
+		}
+		for (size_t i = 0; i < n_samples * n_ch; i++) {
+			store<Dst>(&dst[i * sizeof(Dst)], Convert<Dst, Src>::sample(load<Src>(&in[i * sizeof(Src)])));
+		}
+		return;
+	}
+
+	for (size_t samp = 0; samp < n_samples; samp++) {
+		for (size_t ch = 0; ch < n_ch; ch++) {
+			store<Dst>(dst, Convert<Dst, Src>::sample(load<Src>(&src[ch][(offset + samp) * sizeof(Src)])));
+			dst += sizeof(Dst);
+		}
+	}
+}
+
+// Pick the instantiation of convert_frames() for n_channels
+template <typename Dst, typename Src, bool planar>
+static AudioConvertFn select_channels(uint8_t n_channels) {
+	switch (n_channels) {
+	case 1: return convert_frames<Dst, Src, planar, 1>;
+	case 2: return convert_frames<Dst, Src, planar, 2>;
+	case 3: return convert_frames<Dst, Src, planar, 3>;
+	case 4: return convert_frames<Dst, Src, planar, 4>;
+	case 5: return convert_frames<Dst, Src, planar, 5>;
+	case 6: return convert_frames<Dst, Src, planar, 6>;
+	case 7: return convert_frames<Dst, Src, planar, 7>;
+	case 8: return convert_frames<Dst, Src, planar, 8>;
+	default: return convert_frames<Dst, Src, planar, 0>;
+	}
+}
+
+// Pick a function converting src_fmt into Dst samples
+template <typename Dst>
+static AudioConvertFn select_src(enum AVSampleFormat src_fmt, uint8_t n_channels) {
+	switch (src_fmt) {
+	case AV_SAMPLE_FMT_S16: return select_channels<Dst, int16_t, false>(n_channels);
+	case AV_SAMPLE_FMT_S16P: return select_channels<Dst, int16_t, true>(n_channels);
+	case AV_SAMPLE_FMT_S32: return select_channels<Dst, int32_t, false>(n_channels);
+	case AV_SAMPLE_FMT_S32P: return select_channels<Dst, int32_t, true>(n_channels);
+	case AV_SAMPLE_FMT_FLT: return select_channels<Dst, float, false>(n_channels);
+	case AV_SAMPLE_FMT_FLTP: return select_channels<Dst, float, true>(n_channels);
+	default: return NULL;
+	}
+}
+
+// Pick a function copying samples of sample_size bytes as-is
+template <bool planar>
+static AudioConvertFn select_copy(size_t sample_size, uint8_t n_channels) {
+	switch (sample_size) {
+	case 1: return select_channels<uint8_t, uint8_t, planar>(n_channels);
+	case 2: return select_channels<uint16_t, uint16_t, planar>(n_channels);
+	case 4: return select_channels<uint32_t, uint32_t, planar>(n_channels);
+	case 8: return select_channels<uint64_t, uint64_t, planar>(n_channels);
+	default: return NULL;
+	}
+}
+
+extern "C" {
+
+AudioConvertFn AudioConvert_select(enum AVSampleFormat src_fmt, enum AVSampleFormat dst_fmt, uint8_t n_channels) {
+	if (av_sample_fmt_is_planar(dst_fmt)) {
+		return NULL;
+	}
+
+	// Same format (up to planarity), so samples are copied bit-for-bit
+	if (av_get_packed_sample_fmt(src_fmt) == dst_fmt) {
+		const size_t sample_size = av_get_bytes_per_sample(src_fmt);
+		return av_sample_fmt_is_planar(src_fmt)
+			? select_copy<true>(sample_size, n_channels)
+			: select_copy<false>(sample_size, n_channels);
+	}
+
+	switch (dst_fmt) {
+	case AV_SAMPLE_FMT_S16: return select_src<int16_t>(src_fmt, n_channels);
+	case AV_SAMPLE_FMT_S32: return select_src<int32_t>(src_fmt, n_channels);
+	case AV_SAMPLE_FMT_FLT: return select_src<float>(src_fmt, n_channels);
+	default: return NULL;
+	}
+}
+
+}
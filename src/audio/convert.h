@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+// Convert n_samples (per-ch) samples of n_channels channels, starting at sample # offset, from src into interleaved frames at *dst.
+// src holds one plane per channel for planar formats, or a single plane of interleaved frames for packed formats.
+// Functions specialized for a channel count ignore n_channels.
+typedef void (*AudioConvertFn)(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples, uint8_t n_channels);
+
+// Get a function converting (and interleaving, if src_fmt is planar) samples of src_fmt into samples of packed format dst_fmt.
+// Functions are instantiated at compile time for every supported pair of formats, and for 1-8 channels.
+// Any format can be converted to its own packed format. Otherwise, conversions between S16, S32 and FLT are supported.
+// Returns NULL if the conversion isn't supported.
+AudioConvertFn AudioConvert_select(enum AVSampleFormat src_fmt, enum AVSampleFormat dst_fmt, uint8_t n_channels);
@@ -0,0 +1,339 @@
+#include "interleave.h"
+
+#include <libavutil/samplefmt.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define INTERLEAVE_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define INTERLEAVE_NEON
+#include <arm_neon.h>
+#endif
+
+// Max # of channels a SIMD kernel handles
+#define INTERLEAVE_FIXED_CH_MAX 8
+
+// Interleave samples one frame at a time, used for the samples left over after a SIMD kernel's last full vector.
+// Always inlined so each kernel gets a copy unrolled for its constant n_channels + sample_size.
+static inline __attribute__((always_inline)) void interleave_fixed(unsigned char *restrict dst, const uint8_t *const *src,
+		size_t offset, size_t n_samples, const uint8_t n_channels, const size_t sample_size) {
+	const unsigned char *lines[INTERLEAVE_FIXED_CH_MAX];
+	for (size_t ch = 0; ch < n_channels; ch++) {
+		lines[ch] = &src[ch][offset * sample_size];
+	}
+	for (size_t samp = 0; samp < n_samples; samp++) {
+		for (size_t ch = 0; ch < n_channels; ch++) {
+			memcpy(dst, &lines[ch][samp * sample_size], sample_size);
+			dst += sample_size;
+		}
+	}
+}
+
+// SIMD kernels.
+// Each one interleaves as many whole vectors of samples as it can, then leaves the rest to interleave_fixed().
+
+#ifdef __SSE2__
+static void interleave_2ch_2b_sse2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int16_t *l = (const int16_t *)src[0] + offset;
+	const int16_t *r = (const int16_t *)src[1] + offset;
+	int16_t *out = (int16_t *)dst;
+	size_t i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)&l[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i *)&r[i]);
+		_mm_storeu_si128((__m128i *)&out[2*i], _mm_unpacklo_epi16(a, b));
+		_mm_storeu_si128((__m128i *)&out[2*i + 8], _mm_unpackhi_epi16(a, b));
+	}
+	interleave_fixed(&dst[i * 4], src, offset + i, n_samples - i, 2, 2);
+}
+
+static void interleave_2ch_4b_sse2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *l = (const int32_t *)src[0] + offset;
+	const int32_t *r = (const int32_t *)src[1] + offset;
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 4 <= n_samples; i += 4) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)&l[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i *)&r[i]);
+		_mm_storeu_si128((__m128i *)&out[2*i], _mm_unpacklo_epi32(a, b));
+		_mm_storeu_si128((__m128i *)&out[2*i + 4], _mm_unpackhi_epi32(a, b));
+	}
+	interleave_fixed(&dst[i * 8], src, offset + i, n_samples - i, 2, 4);
+}
+
+// Transpose 4 channels x 4 samples of 32-bit samples into 4 samples x 4 channels
+static inline void transpose_4x4_epi32(__m128i v[4]) {
+	const __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+	const __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+	const __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+	const __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+	v[0] = _mm_unpacklo_epi64(t0, t1);
+	v[1] = _mm_unpackhi_epi64(t0, t1);
+	v[2] = _mm_unpacklo_epi64(t2, t3);
+	v[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+static void interleave_6ch_4b_sse2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *lines[6];
+	for (size_t ch = 0; ch < 6; ch++) {
+		lines[ch] = (const int32_t *)src[ch] + offset;
+	}
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 4 <= n_samples; i += 4) {
+		__m128i front[4];
+		for (size_t ch = 0; ch < 4; ch++) {
+			front[ch] = _mm_loadu_si128((const __m128i *)&lines[ch][i]);
+		}
+		transpose_4x4_epi32(front);
+		const __m128i c4 = _mm_loadu_si128((const __m128i *)&lines[4][i]);
+		const __m128i c5 = _mm_loadu_si128((const __m128i *)&lines[5][i]);
+		const __m128i back[2] = {_mm_unpacklo_epi32(c4, c5), _mm_unpackhi_epi32(c4, c5)};
+		for (size_t s = 0; s < 4; s++) {
+			int32_t *frame = &out[(i + s) * 6];
+			_mm_storeu_si128((__m128i *)frame, front[s]);
+			const __m128i pair = s % 2 ? _mm_unpackhi_epi64(back[s/2], back[s/2]) : back[s/2];
+			_mm_storel_epi64((__m128i *)&frame[4], pair);
+		}
+	}
+	interleave_fixed(&dst[i * 24], src, offset + i, n_samples - i, 6, 4);
+}
+
+static void interleave_8ch_2b_sse2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int16_t *lines[8];
+	for (size_t ch = 0; ch < 8; ch++) {
+		lines[ch] = (const int16_t *)src[ch] + offset;
+	}
+	int16_t *out = (int16_t *)dst;
+	size_t i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		__m128i a[8];
+		for (size_t ch = 0; ch < 8; ch++) {
+			a[ch] = _mm_loadu_si128((const __m128i *)&lines[ch][i]);
+		}
+		// 8x8 transpose: pair up channels, then pairs of pairs, then halves
+		__m128i b[8];
+		for (size_t k = 0; k < 4; k++) {
+			b[2*k] = _mm_unpacklo_epi16(a[2*k], a[2*k + 1]);
+			b[2*k + 1] = _mm_unpackhi_epi16(a[2*k], a[2*k + 1]);
+		}
+		const __m128i c[8] = {
+			_mm_unpacklo_epi32(b[0], b[2]), _mm_unpackhi_epi32(b[0], b[2]),
+			_mm_unpacklo_epi32(b[1], b[3]), _mm_unpackhi_epi32(b[1], b[3]),
+			_mm_unpacklo_epi32(b[4], b[6]), _mm_unpackhi_epi32(b[4], b[6]),
+			_mm_unpacklo_epi32(b[5], b[7]), _mm_unpackhi_epi32(b[5], b[7]),
+		};
+		for (size_t k = 0; k < 4; k++) {
+			_mm_storeu_si128((__m128i *)&out[(i + 2*k) * 8], _mm_unpacklo_epi64(c[k], c[k + 4]));
+			_mm_storeu_si128((__m128i *)&out[(i + 2*k + 1) * 8], _mm_unpackhi_epi64(c[k], c[k + 4]));
+		}
+	}
+	interleave_fixed(&dst[i * 16], src, offset + i, n_samples - i, 8, 2);
+}
+
+static void interleave_8ch_4b_sse2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *lines[8];
+	for (size_t ch = 0; ch < 8; ch++) {
+		lines[ch] = (const int32_t *)src[ch] + offset;
+	}
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 4 <= n_samples; i += 4) {
+		__m128i front[4], back[4];
+		for (size_t ch = 0; ch < 4; ch++) {
+			front[ch] = _mm_loadu_si128((const __m128i *)&lines[ch][i]);
+			back[ch] = _mm_loadu_si128((const __m128i *)&lines[ch + 4][i]);
+		}
+		transpose_4x4_epi32(front);
+		transpose_4x4_epi32(back);
+		for (size_t s = 0; s < 4; s++) {
+			_mm_storeu_si128((__m128i *)&out[(i + s) * 8], front[s]);
+			_mm_storeu_si128((__m128i *)&out[(i + s) * 8 + 4], back[s]);
+		}
+	}
+	interleave_fixed(&dst[i * 32], src, offset + i, n_samples - i, 8, 4);
+}
+#endif
+
+#ifdef INTERLEAVE_X86
+#define AVX2 __attribute__((target("avx2")))
+
+// NOTE: AVX2 unpacks work within each 128-bit lane, so each pair of results is recombined across lanes before storing
+
+AVX2 static void interleave_2ch_2b_avx2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int16_t *l = (const int16_t *)src[0] + offset;
+	const int16_t *r = (const int16_t *)src[1] + offset;
+	int16_t *out = (int16_t *)dst;
+	size_t i = 0;
+	for (; i + 16 <= n_samples; i += 16) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)&l[i]);
+		const __m256i b = _mm256_loadu_si256((const __m256i *)&r[i]);
+		const __m256i lo = _mm256_unpacklo_epi16(a, b);
+		const __m256i hi = _mm256_unpackhi_epi16(a, b);
+		_mm256_storeu_si256((__m256i *)&out[2*i], _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)&out[2*i + 16], _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave_fixed(&dst[i * 4], src, offset + i, n_samples - i, 2, 2);
+}
+
+AVX2 static void interleave_2ch_4b_avx2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *l = (const int32_t *)src[0] + offset;
+	const int32_t *r = (const int32_t *)src[1] + offset;
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)&l[i]);
+		const __m256i b = _mm256_loadu_si256((const __m256i *)&r[i]);
+		const __m256i lo = _mm256_unpacklo_epi32(a, b);
+		const __m256i hi = _mm256_unpackhi_epi32(a, b);
+		_mm256_storeu_si256((__m256i *)&out[2*i], _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)&out[2*i + 8], _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	interleave_fixed(&dst[i * 8], src, offset + i, n_samples - i, 2, 4);
+}
+
+AVX2 static void interleave_8ch_4b_avx2(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *lines[8];
+	for (size_t ch = 0; ch < 8; ch++) {
+		lines[ch] = (const int32_t *)src[ch] + offset;
+	}
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		__m256i a[8];
+		for (size_t ch = 0; ch < 8; ch++) {
+			a[ch] = _mm256_loadu_si256((const __m256i *)&lines[ch][i]);
+		}
+		// 8x8 transpose: 4x4 transposes within each lane, then swap lanes between the front and back channels
+		__m256i t[8];
+		for (size_t k = 0; k < 4; k++) {
+			t[2*k] = _mm256_unpacklo_epi32(a[2*k], a[2*k + 1]);
+			t[2*k + 1] = _mm256_unpackhi_epi32(a[2*k], a[2*k + 1]);
+		}
+		const __m256i u[8] = {
+			_mm256_unpacklo_epi64(t[0], t[2]), _mm256_unpackhi_epi64(t[0], t[2]),
+			_mm256_unpacklo_epi64(t[1], t[3]), _mm256_unpackhi_epi64(t[1], t[3]),
+			_mm256_unpacklo_epi64(t[4], t[6]), _mm256_unpackhi_epi64(t[4], t[6]),
+			_mm256_unpacklo_epi64(t[5], t[7]), _mm256_unpackhi_epi64(t[5], t[7]),
+		};
+		for (size_t s = 0; s < 4; s++) {
+			_mm256_storeu_si256((__m256i *)&out[(i + s) * 8], _mm256_permute2x128_si256(u[s], u[s + 4], 0x20));
+			_mm256_storeu_si256((__m256i *)&out[(i + s + 4) * 8], _mm256_permute2x128_si256(u[s], u[s + 4], 0x31));
+		}
+	}
+	interleave_fixed(&dst[i * 32], src, offset + i, n_samples - i, 8, 4);
+}
+#undef AVX2
+#endif
+
+#ifdef INTERLEAVE_NEON
+static void interleave_2ch_2b_neon(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int16_t *l = (const int16_t *)src[0] + offset;
+	const int16_t *r = (const int16_t *)src[1] + offset;
+	int16_t *out = (int16_t *)dst;
+	size_t i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		const int16x8x2_t v = {{vld1q_s16(&l[i]), vld1q_s16(&r[i])}};
+		vst2q_s16(&out[2*i], v);
+	}
+	interleave_fixed(&dst[i * 4], src, offset + i, n_samples - i, 2, 2);
+}
+
+static void interleave_2ch_4b_neon(unsigned char *dst, const uint8_t *const *src, size_t offset, size_t n_samples,
+		uint8_t n_channels) {
+	const int32_t *l = (const int32_t *)src[0] + offset;
+	const int32_t *r = (const int32_t *)src[1] + offset;
+	int32_t *out = (int32_t *)dst;
+	size_t i = 0;
+	for (; i + 4 <= n_samples; i += 4) {
+		const int32x4x2_t v = {{vld1q_s32(&l[i]), vld1q_s32(&r[i])}};
+		vst2q_s32(&out[2*i], v);
+	}
+	interleave_fixed(&dst[i * 8], src, offset + i, n_samples - i, 2, 4);
+}
+#endif
+
+
+// A kernel for one layout of planar samples
+typedef struct InterleaveKernel {
+	size_t sample_size;
+	uint8_t n_channels;
+	AudioConvertFn fn;
+} InterleaveKernel;
+
+#ifdef INTERLEAVE_X86
+static const InterleaveKernel KERNELS_AVX2[] = {
+	{2, 2, interleave_2ch_2b_avx2},
+	{4, 2, interleave_2ch_4b_avx2},
+	{4, 8, interleave_8ch_4b_avx2},
+};
+#endif
+#ifdef __SSE2__
+static const InterleaveKernel KERNELS_SSE2[] = {
+	{2, 2, interleave_2ch_2b_sse2},
+	{4, 2, interleave_2ch_4b_sse2},
+	{4, 6, interleave_6ch_4b_sse2},
+	{2, 8, interleave_8ch_2b_sse2},
+	{4, 8, interleave_8ch_4b_sse2},
+};
+#endif
+#ifdef INTERLEAVE_NEON
+static const InterleaveKernel KERNELS_NEON[] = {
+	{2, 2, interleave_2ch_2b_neon},
+	{4, 2, interleave_2ch_4b_neon},
+};
+#endif
+// Find the kernel for a layout in kernels[n], returning NULL if there isn't one
+static AudioConvertFn InterleaveKernel_find(const InterleaveKernel *kernels, size_t n, size_t sample_size, uint8_t n_channels) {
+	for (size_t i = 0; i < n; i++) {
+		if (kernels[i].sample_size == sample_size && kernels[i].n_channels == n_channels) {
+			return kernels[i].fn;
+		}
+	}
+	return NULL;
+}
+#define KERNELS_FIND(kernels, sample_size, n_channels) \
+	InterleaveKernel_find(kernels, sizeof(kernels) / sizeof(kernels[0]), sample_size, n_channels)
+
+AudioConvertFn AudioInterleave_select(const AudioPCM *pcm) {
+	const size_t sample_size = av_get_bytes_per_sample(pcm->sample_fmt);
+	const uint8_t n_channels = pcm->n_channels;
+	const enum AVSampleFormat packed_fmt = av_get_packed_sample_fmt(pcm->sample_fmt);
+	if (!av_sample_fmt_is_planar(pcm->sample_fmt) || n_channels == 1) {
+		// Nothing to interleave
+		return AudioConvert_select(pcm->sample_fmt, packed_fmt, n_channels);
+	}
+
+	AudioConvertFn fn = NULL;
+#ifdef INTERLEAVE_X86
+	if (__builtin_cpu_supports("avx2")) {
+		fn = KERNELS_FIND(KERNELS_AVX2, sample_size, n_channels);
+	}
+#endif
+#ifdef __SSE2__
+	if (!fn) {
+		fn = KERNELS_FIND(KERNELS_SSE2, sample_size, n_channels);
+	}
+#endif
+#ifdef INTERLEAVE_NEON
+	if (!fn) {
+		fn = KERNELS_FIND(KERNELS_NEON, sample_size, n_channels);
+	}
+#endif
+	if (!fn) {
+		fn = AudioConvert_select(pcm->sample_fmt, packed_fmt, n_channels);
+	}
+	return fn;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "convert.h"
+#include "pcm.h"
+
+// Pick the fastest function for writing decoded frames of *pcm's format into interleaved frames of the same format.
+// Planar formats are interleaved with a SIMD kernel for the sample size + channel count where there is one
+// (chosen by the CPU features available at runtime), and an AudioConvert_select() function otherwise.
+// Returns NULL if *pcm's format isn't supported.
+AudioConvertFn AudioInterleave_select(const AudioPCM *pcm);
@@ -0,0 +1,641 @@
+#include "io.h"
+#include "error.h"
+#include "util/log.h"
+#include "util/path.h"
+#ifdef MPL_IO_URING
+#include "util/uring.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Size of the AVIOContext buffer when reading from a mapped file. Reads are just a memcpy() then, so bigger doesn't help
+static const int IO_MMAP_BUFFER_SIZE = 64 * 1024;
+
+struct AudioFileData {
+	atomic_size_t refs;
+	unsigned char *data;
+	size_t size;
+};
+
+struct AudioIO {
+	AVIOContext *avio;
+	int fd; // -1 if the file is read from memory
+	int64_t size; // File size when it was opened
+	int64_t pos; // Offset of the next read
+	const unsigned char *map; // File contents, if mapped (or held in memory)
+	AudioFileData *data; // File contents held in memory, which map points into
+
+	// Page cache hints, made in windows of window bytes
+	int64_t window;
+	size_t page_size;
+	int64_t run_start; // Offset the demuxer last seeked to, which it's been reading on from since
+	int64_t advised; // End of what the kernel's been asked to read ahead
+	int64_t dropped; // End of what's been dropped from the page cache behind the current run (page aligned)
+
+	// Prefetching (see AudioIO_prefetch()): a thread reads the file into a ring ahead of the demuxer.
+	// The byte at file offset o is held at ring[o % ring_size].
+	pthread_t prefetch_thread;
+	bool prefetching; // Whether the thread has been started
+	pthread_mutex_t lock; // Guards everything below
+	pthread_cond_t cond; // Signalled whenever the ring is filled, drained or reset, and on stop
+	unsigned char *ring;
+	size_t ring_size;
+	int64_t ring_start, ring_end; // File range held in the ring
+	int ring_err; // Error (averror) hit reading at ring_end, returned once the demuxer gets there
+	uint64_t generation; // Bumped when the ring is reset, so reads made for where it was before are dropped
+	bool stop;
+	// How long (and how often) the demuxer had to wait for the thread
+	uint64_t stall_ns;
+	size_t n_stalls;
+
+#ifdef MPL_IO_URING
+	// When set up, the prefetch thread keeps up to uring_depth reads in flight through io_uring, instead of blocking on one
+	unsigned uring_depth;
+	URing *uring;
+	bool uring_failed; // Whether reads were left in flight (and the ring can't be freed from under them)
+	size_t n_uring_reads, n_uring_submits;
+#endif
+};
+
+// Size of the reads made by the prefetch thread
+static const size_t IO_PREFETCH_CHUNK = 256 * 1024;
+
+#ifndef __WIN32
+// Drop [io->dropped, end) from the page cache (end must be page aligned)
+static void AudioIO_drop(AudioIO *io, int64_t end) {
+	if (io->data || end <= io->dropped) {
+		return;
+	}
+	// Mapped pages have to be unmapped from us first, or the page cache holds on to them
+	if (io->map) {
+		madvise((void *)(io->map + io->dropped), end - io->dropped, MADV_DONTNEED);
+	}
+	posix_fadvise(io->fd, io->dropped, end - io->dropped, POSIX_FADV_DONTNEED);
+	io->dropped = end;
+}
+
+// Keep the kernel reading ahead of io->pos, and drop pages more than a window behind it
+static void AudioIO_advise(AudioIO *io) {
+	if (io->data) {
+		return;
+	}
+	// Wait until the demuxer is streaming through the file, so probing a track doesn't read more of it than it needs
+	if (io->pos - io->run_start < io->window) {
+		return;
+	}
+	// (The prefetch thread reads ahead itself, if there is one)
+	if (!io->prefetching && io->pos + io->window / 2 > io->advised) {
+		const int64_t start = io->advised > io->pos ? io->advised : io->pos;
+		const int64_t end = io->pos + 2 * io->window;
+		posix_fadvise(io->fd, start, end - start, POSIX_FADV_WILLNEED);
+		io->advised = end;
+	}
+	// Drop in whole windows, rather than a sliver every read
+	const int64_t drop_end = (io->pos - io->window) & ~(int64_t)(io->page_size - 1);
+	if (drop_end - io->dropped >= io->window) {
+		AudioIO_drop(io, drop_end);
+	}
+}
+
+// Read up to n bytes of io's file at offset into *dst.
+// Returns the # of bytes read, or an averror (AVERROR_EOF past the end of the file)
+static int64_t AudioIO_read_file(AudioIO *io, unsigned char *dst, size_t n, int64_t offset) {
+	int64_t n_read;
+	if (io->map) {
+		n_read = io->size - offset < (int64_t)n ? io->size - offset : (int64_t)n;
+		if (n_read > 0) {
+			memcpy(dst, io->map + offset, n_read);
+		}
+	} else {
+		do {
+			n_read = pread(io->fd, dst, n, offset);
+		} while (n_read < 0 && errno == EINTR);
+		if (n_read < 0) {
+			return AVERROR(errno);
+		}
+	}
+	return n_read > 0 ? n_read : AVERROR_EOF;
+}
+
+static uint64_t AudioIO_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Read up to n bytes at io->pos out of the prefetch ring, waiting for the prefetch thread if it hasn't got there yet.
+// Returns the # of bytes read, or an averror
+static int64_t AudioIO_read_prefetched(AudioIO *io, unsigned char *dst, size_t n) {
+	pthread_mutex_lock(&io->lock);
+	if (io->pos < io->ring_start || io->pos > io->ring_end) {
+		// The demuxer seeked away from what's prefetched: start over from where it is now
+		io->ring_start = io->ring_end = io->pos;
+		io->ring_err = 0;
+		io->generation++;
+	} else {
+		// Everything before io->pos has been consumed
+		io->ring_start = io->pos;
+	}
+	pthread_cond_broadcast(&io->cond);
+
+	if (io->ring_end == io->pos && !io->ring_err && io->pos < io->size) {
+		const uint64_t start = AudioIO_now_ns();
+		while (io->ring_end == io->pos && !io->ring_err && io->pos < io->size) {
+			pthread_cond_wait(&io->cond, &io->lock);
+		}
+		io->stall_ns += AudioIO_now_ns() - start;
+		io->n_stalls++;
+	}
+
+	int64_t n_read = io->ring_err ? io->ring_err : AVERROR_EOF;
+	if (io->ring_end > io->pos) {
+		// Copy up to the end of the ring, the caller comes back for the rest
+		const size_t ring_pos = io->pos % io->ring_size;
+		n_read = io->ring_end - io->pos;
+		if ((size_t)n_read > n) {
+			n_read = n;
+		}
+		if ((size_t)n_read > io->ring_size - ring_pos) {
+			n_read = io->ring_size - ring_pos;
+		}
+		// The prefetch thread never writes to [ring_start, ring_end), so the copy can be made unlocked
+		pthread_mutex_unlock(&io->lock);
+		memcpy(dst, io->ring + ring_pos, n_read);
+		return n_read;
+	}
+	pthread_mutex_unlock(&io->lock);
+	return n_read;
+}
+
+static int AudioIO_read(void *opaque, uint8_t *buf, int buf_size) {
+	AudioIO *io = opaque;
+
+	const int64_t n = io->prefetching
+		? AudioIO_read_prefetched(io, buf, buf_size)
+		: AudioIO_read_file(io, buf, buf_size, io->pos);
+	if (n < 0) {
+		return n;
+	}
+	io->pos += n;
+	AudioIO_advise(io);
+
+	return n;
+}
+
+// Keep the prefetch ring full, reading ahead of the demuxer until the end of the file
+static void *AudioIO_prefetch_routine(void *args) {
+	AudioIO *io = args;
+
+	pthread_mutex_lock(&io->lock);
+	while (!io->stop) {
+		const size_t n_free = io->ring_size - (io->ring_end - io->ring_start);
+		if (io->ring_err || io->ring_end >= io->size || n_free == 0) {
+			pthread_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+
+		// Read into free space up to the end of the ring, without holding the lock
+		const int64_t offset = io->ring_end;
+		const uint64_t generation = io->generation;
+		const size_t ring_pos = offset % io->ring_size;
+		size_t n = IO_PREFETCH_CHUNK;
+		if (n > n_free) {
+			n = n_free;
+		}
+		if (n > io->ring_size - ring_pos) {
+			n = io->ring_size - ring_pos;
+		}
+		pthread_mutex_unlock(&io->lock);
+		const int64_t n_read = AudioIO_read_file(io, io->ring + ring_pos, n, offset);
+		pthread_mutex_lock(&io->lock);
+
+		if (generation != io->generation) {
+			// The ring was reset while we were reading
+			continue;
+		}
+		if (n_read < 0) {
+			io->ring_err = n_read;
+		} else {
+			io->ring_end += n_read;
+		}
+		pthread_cond_broadcast(&io->cond);
+	}
+	pthread_mutex_unlock(&io->lock);
+
+	return NULL;
+}
+
+#ifdef MPL_IO_URING
+// A read of [offset, offset + n) into the prefetch ring, made through io_uring
+typedef struct AudioIO_URingRead {
+	int64_t offset;
+	size_t n;
+	uint64_t generation; // io->generation when the read was made
+	bool done;
+	int32_t res; // Bytes read, or a negative errno (once done)
+} AudioIO_URingRead;
+
+// Keep the prefetch ring full like AudioIO_prefetch_routine(), with up to io->uring_depth reads in flight at once.
+// Reads complete in any order, and are published to the demuxer in file order.
+static void *AudioIO_prefetch_uring_routine(void *args) {
+	AudioIO *io = args;
+
+	AudioIO_URingRead reads[io->uring_depth]; // Reads in flight, in file order from reads[head]
+	size_t head = 0, n_reads = 0;
+	int64_t reads_end = 0; // End of what the reads in flight cover
+
+	pthread_mutex_lock(&io->lock);
+	while (true) {
+		// Reads in flight only ever follow on from io->ring_end. If they don't, the ring was reset (or a read fell short),
+		// and they have to land before anything more is read into the ring.
+		const bool in_sync = n_reads == 0
+			|| (reads[head].generation == io->generation && reads[head].offset == io->ring_end);
+		if (n_reads == 0) {
+			reads_end = io->ring_end;
+		}
+		while (!io->stop && !io->ring_err && in_sync && n_reads < io->uring_depth && reads_end < io->size) {
+			const size_t n_free = io->ring_size - (reads_end - io->ring_start);
+			if (n_free == 0) {
+				break;
+			}
+			const size_t ring_pos = reads_end % io->ring_size;
+			size_t n = IO_PREFETCH_CHUNK;
+			if (n > n_free) {
+				n = n_free;
+			}
+			if (n > io->ring_size - ring_pos) {
+				n = io->ring_size - ring_pos;
+			}
+			if ((int64_t)n > io->size - reads_end) {
+				n = io->size - reads_end;
+			}
+			const size_t slot = (head + n_reads) % io->uring_depth;
+			if (URing_prep_read(io->uring, io->fd, io->ring + ring_pos, n, reads_end, slot) != 0) {
+				break;
+			}
+			reads[slot] = (AudioIO_URingRead){
+				.offset = reads_end, .n = n, .generation = io->generation,
+			};
+			n_reads++;
+			reads_end += n;
+			io->n_uring_reads++;
+		}
+		if (n_reads == 0) {
+			if (io->stop) {
+				break;
+			}
+			pthread_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+
+		// Submit what's been queued and wait for something to complete, without holding the lock
+		pthread_mutex_unlock(&io->lock);
+		int status;
+		do {
+			status = URing_submit(io->uring, 1);
+		} while (status == -EINTR || status == -EAGAIN || status == -EBUSY);
+		uint64_t slot;
+		int32_t res;
+		while (URing_reap(io->uring, &slot, &res)) {
+			reads[slot].done = true;
+			reads[slot].res = res;
+		}
+		pthread_mutex_lock(&io->lock);
+		io->n_uring_submits++;
+
+		if (status < 0) {
+			// We can't wait on the reads in flight anymore: give up prefetching. They can't be cancelled either,
+			// so the ring is leaked rather than freed from under them
+			LOG(Verbosity_NORMAL, "io_uring failed: %s\n", strerror(-status));
+			io->ring_err = AVERROR(-status);
+			io->uring_failed = true;
+			pthread_cond_broadcast(&io->cond);
+			break;
+		}
+
+		// Publish the reads that have completed in order. Ones made for where the ring was before it was reset,
+		// or which follow a read that fell short, are dropped
+		bool published = false;
+		while (n_reads > 0 && reads[head].done) {
+			const AudioIO_URingRead *done = &reads[head];
+			head = (head + 1) % io->uring_depth;
+			n_reads--;
+			if (done->generation != io->generation || done->offset != io->ring_end || io->ring_err) {
+				continue;
+			}
+			if (done->res < 0) {
+				io->ring_err = AVERROR(-done->res);
+			} else if (done->res == 0) {
+				io->ring_err = AVERROR_EOF;
+			} else {
+				io->ring_end += done->res;
+			}
+			published = true;
+		}
+		if (published) {
+			pthread_cond_broadcast(&io->cond);
+		}
+	}
+	pthread_mutex_unlock(&io->lock);
+
+	return NULL;
+}
+#endif
+
+static int64_t AudioIO_seek(void *opaque, int64_t offset, int whence) {
+	AudioIO *io = opaque;
+
+	int64_t pos;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return io->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = io->pos + offset;
+		break;
+	case SEEK_END:
+		pos = io->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	// Start a new run: only what's read from here on is dropped behind us
+	io->pos = pos;
+	io->run_start = pos;
+	io->advised = pos;
+	io->dropped = pos & ~(int64_t)(io->page_size - 1);
+	return pos;
+}
+#endif
+
+// Free *io, and set it to NULL
+static void AudioIO_free(AudioIO **io) {
+	if (!*io) {
+		return;
+	}
+#ifndef __WIN32
+	if ((*io)->prefetching) {
+		pthread_mutex_lock(&(*io)->lock);
+		(*io)->stop = true;
+		pthread_cond_broadcast(&(*io)->cond);
+		pthread_mutex_unlock(&(*io)->lock);
+		pthread_join((*io)->prefetch_thread, NULL);
+		LOG(Verbosity_VERBOSE, "Waited on I/O %zu times, for %.1f ms in total\n",
+				(*io)->n_stalls, (*io)->stall_ns / 1e6);
+	}
+#ifdef MPL_IO_URING
+	if ((*io)->uring) {
+		LOG(Verbosity_VERBOSE, "Made %zu reads through io_uring in %zu system calls\n",
+				(*io)->n_uring_reads, (*io)->n_uring_submits);
+		URing_free((*io)->uring);
+	}
+#endif
+	pthread_cond_destroy(&(*io)->cond);
+	pthread_mutex_destroy(&(*io)->lock);
+#ifdef MPL_IO_URING
+	if (!(*io)->uring_failed) {
+		free((*io)->ring);
+	}
+#else
+	free((*io)->ring);
+#endif
+	// Drop what's left of a run we streamed through
+	if ((*io)->pos - (*io)->run_start >= (*io)->window) {
+		AudioIO_drop(*io, (*io)->pos & ~(int64_t)((*io)->page_size - 1));
+	}
+	if ((*io)->avio) {
+		av_freep(&(*io)->avio->buffer);
+		avio_context_free(&(*io)->avio);
+	}
+	if ((*io)->data) {
+		AudioFileData_unref((*io)->data);
+	} else if ((*io)->map) {
+		munmap((void *)(*io)->map, (*io)->size);
+	}
+	if ((*io)->fd >= 0) {
+		close((*io)->fd);
+	}
+#endif
+	free(*io);
+	*io = NULL;
+}
+
+#ifndef __WIN32
+// Open the local file at path for reading through an AVIOContext.
+// Returns NULL if it isn't a regular file we can open, in which case libavformat is left to open it.
+static AudioIO *AudioIO_new(const char *path, const Settings *settings) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	AudioIO *io = malloc(sizeof(AudioIO));
+	if (!io) {
+		close(fd);
+		return NULL;
+	}
+	memset(io, 0, sizeof(AudioIO));
+	io->fd = fd;
+	io->size = st.st_size;
+	io->page_size = sysconf(_SC_PAGESIZE);
+	io->window = (int64_t)settings->at_io_readahead_kb * 1024;
+#ifdef MPL_IO_URING
+	io->uring_depth = settings->at_io_uring_depth;
+#endif
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->cond, NULL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	int buffer_size = io->window;
+	if (settings->at_io_mmap && io->size > 0) {
+		void *map = mmap(NULL, io->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, io->size, MADV_SEQUENTIAL);
+			io->map = map;
+			buffer_size = IO_MMAP_BUFFER_SIZE;
+		} else {
+			LOG(Verbosity_DEBUG, "Failed to map %s, reading it instead\n", path);
+		}
+	}
+
+	unsigned char *buffer = av_malloc(buffer_size);
+	if (buffer) {
+		io->avio = avio_alloc_context(buffer, buffer_size, 0, io, AudioIO_read, NULL, AudioIO_seek);
+	}
+	if (!io->avio) {
+		av_free(buffer);
+		AudioIO_free(&io);
+		return NULL;
+	}
+	return io;
+}
+
+// Open an AudioIO reading the file held in *data, taking over the caller's reference to it.
+// Returns NULL on allocation failure.
+static AudioIO *AudioIO_new_data(AudioFileData *data) {
+	AudioIO *io = malloc(sizeof(AudioIO));
+	if (!io) {
+		AudioFileData_unref(data);
+		return NULL;
+	}
+	memset(io, 0, sizeof(AudioIO));
+	io->fd = -1;
+	io->data = data;
+	io->map = data->data;
+	io->size = data->size;
+	io->page_size = sysconf(_SC_PAGESIZE);
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->cond, NULL);
+
+	unsigned char *buffer = av_malloc(IO_MMAP_BUFFER_SIZE);
+	if (buffer) {
+		io->avio = avio_alloc_context(buffer, IO_MMAP_BUFFER_SIZE, 0, io, AudioIO_read, NULL, AudioIO_seek);
+	}
+	if (!io->avio) {
+		av_free(buffer);
+		AudioIO_free(&io);
+		return NULL;
+	}
+	return io;
+}
+#endif
+
+int AudioIO_open_input(AVFormatContext **avf_ctx, AudioIO **io, const char *url, const Settings *settings, AudioFileData *data) {
+	*io = NULL;
+#ifdef __WIN32
+	if (data) {
+		AudioFileData_unref(data);
+	}
+#else
+	const char *path = path_from_url(url);
+	if (data) {
+		*io = AudioIO_new_data(data);
+	} else if (path && settings->at_io_readahead_kb > 0) {
+		*io = AudioIO_new(path, settings);
+	}
+	if (*io) {
+		*avf_ctx = avformat_alloc_context();
+		if (!*avf_ctx) {
+			AudioIO_free(io);
+			return AVERROR(ENOMEM);
+		}
+		(*avf_ctx)->pb = (*io)->avio;
+		(*avf_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+#endif
+
+	// NOTE: this frees *avf_ctx on failure, but leaves our AVIOContext to us
+	const int status = avformat_open_input(avf_ctx, url, NULL, NULL);
+	if (status < 0) {
+		AudioIO_free(io);
+	}
+	return status;
+}
+
+void AudioIO_close_input(AVFormatContext **avf_ctx, AudioIO **io) {
+	avformat_close_input(avf_ctx);
+	AudioIO_free(io);
+}
+
+int AudioIO_prefetch(AudioIO *io, size_t n_bytes) {
+#ifdef __WIN32
+	return 0;
+#else
+	if (!io || io->data || io->prefetching || n_bytes == 0) {
+		return 0;
+	}
+	io->ring = malloc(n_bytes);
+	CHECK_ALLOC(io->ring, 1);
+	io->ring_size = n_bytes;
+	io->ring_start = io->ring_end = io->pos;
+
+	void *(*routine)(void *) = AudioIO_prefetch_routine;
+#ifdef MPL_IO_URING
+	if (io->uring_depth > 0) {
+		io->uring = URing_new(io->uring_depth);
+		if (io->uring) {
+			routine = AudioIO_prefetch_uring_routine;
+		} else {
+			LOG(Verbosity_DEBUG, "io_uring is unavailable, prefetching with blocking reads\n");
+		}
+	}
+#endif
+
+	if (pthread_create(&io->prefetch_thread, NULL, routine, io) != 0) {
+#ifdef MPL_IO_URING
+		if (io->uring) {
+			URing_free(io->uring);
+			io->uring = NULL;
+		}
+#endif
+		free(io->ring);
+		io->ring = NULL;
+		return 1;
+	}
+	io->prefetching = true;
+	return 0;
+#endif
+}
+
+size_t AudioIO_buffer_size(const AudioIO *io) {
+	if (!io) {
+		return 0;
+	}
+	return (io->avio ? (size_t)io->avio->buffer_size : 0) + io->ring_size;
+}
+
+AudioFileData *AudioIO_file_data(const AudioIO *io) {
+	return io && io->data ? AudioFileData_ref(io->data) : NULL;
+}
+
+AudioFileData *AudioFileData_new(unsigned char *data, size_t size) {
+	AudioFileData *fd = malloc(sizeof(AudioFileData));
+	CHECK_ALLOC(fd, NULL);
+	atomic_init(&fd->refs, 1);
+	fd->data = data;
+	fd->size = size;
+	return fd;
+}
+
+AudioFileData *AudioFileData_ref(AudioFileData *fd) {
+	atomic_fetch_add_explicit(&fd->refs, 1, memory_order_relaxed);
+	return fd;
+}
+
+void AudioFileData_unref(AudioFileData *fd) {
+	if (atomic_fetch_sub_explicit(&fd->refs, 1, memory_order_acq_rel) == 1) {
+		free(fd->data);
+		free(fd);
+	}
+}
+
+size_t AudioFileData_size(const AudioFileData *fd) {
+	return fd->size;
+}
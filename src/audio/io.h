@@ -0,0 +1,45 @@
+#pragma once
+#include "config/settings.h"
+
+#include <libavformat/avformat.h>
+
+// mpl's own reader for local track files, handed to libavformat as a custom AVIOContext in place of its file: protocol.
+// Files are either read in chunks of at_io_readahead_kb or mapped into memory (at_io_mmap). Either way the kernel is
+// told to read ahead of the demuxer, and to drop the pages it has left behind from the page cache, so playing through
+// a whole library doesn't evict everything else.
+// Files can also be read from memory they were read into ahead of time (see AudioFileData).
+typedef struct AudioIO AudioIO;
+
+// The contents of a file, read into memory and shared by reference count between whoever is reading it
+typedef struct AudioFileData AudioFileData;
+
+// Wrap size bytes of file contents at *data (allocated using malloc), taking ownership of them. The new AudioFileData
+// holds one reference. Returns NULL on allocation failure (in which case the caller keeps ownership of data).
+AudioFileData *AudioFileData_new(unsigned char *data, size_t size);
+// Take another reference to *fd, returning fd
+AudioFileData *AudioFileData_ref(AudioFileData *fd);
+// Release a reference to *fd, freeing it along with its contents once there are none left
+void AudioFileData_unref(AudioFileData *fd);
+// Get the size (in bytes) of the file held in *fd
+size_t AudioFileData_size(const AudioFileData *fd);
+
+// Open url for demuxing into *avf_ctx (see avformat_open_input()), reading local files through an AudioIO set up for *settings.
+// If data isn't NULL, url's file is read from there instead. This takes over the caller's reference to data.
+// *io is set to the AudioIO, or NULL if url is opened by libavformat itself (i.e it isn't a local file).
+// Return value is an averror
+int AudioIO_open_input(AVFormatContext **avf_ctx, AudioIO **io, const char *url, const Settings *settings, AudioFileData *data);
+// Close a demuxer opened with AudioIO_open_input(), along with its AudioIO
+void AudioIO_close_input(AVFormatContext **avf_ctx, AudioIO **io);
+
+// Get a new reference to the file contents io reads from memory, or NULL if io is NULL or reads its file from disk
+AudioFileData *AudioIO_file_data(const AudioIO *io);
+
+// Start reading io's file ahead of the demuxer on a background thread, into a ring of n_bytes, so demuxing is served
+// from memory and storage hiccups are absorbed before they can stall decoding.
+// The time the demuxer spent waiting on the thread anyway is logged when io is closed.
+// Does nothing if io is NULL, reads from memory, is already prefetching, or n_bytes is 0.
+// Returns 0 on success, nonzero on error
+int AudioIO_prefetch(AudioIO *io, size_t n_bytes);
+// Get the # of bytes io's own buffers take up (its read buffer and prefetch ring), not counting file contents it reads from memory.
+// Returns 0 if io is NULL
+size_t AudioIO_buffer_size(const AudioIO *io);
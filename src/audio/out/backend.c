@@ -1,13 +1,23 @@
+#define _GNU_SOURCE // RUSAGE_THREAD
 #include "config/config.h"
 #include "ui/event_queue.h"
+#include <stdatomic.h>
 #include <string.h>
+#ifndef __WIN32
+#include <sys/resource.h>
+#endif
 
 #include "backend.h"
 #include "error.h"
 #include "util/log.h"
 
+// Whether AudioBackend_count_faults() counts anything: only when the count is logged, or buffers are locked to avoid faults
+static bool count_faults = false;
+
 // Initialize an AudioBackend for playback
 enum AudioBackend_ERR AudioBackend_init(AudioBackend *ab, EventQueue *eq, const Settings *settings) {
+	count_faults = settings->at_buffer_lock || cli_args.verbosity >= Verbosity_VERBOSE;
+
 	// Allocate and zero ctx
 	ab->ctx = malloc(ab->ctx_size);
 	CHECK_ALLOC(ab->ctx, AudioBackend_BAD_ALLOC);
@@ -21,6 +31,12 @@ void AudioBackend_deinit(AudioBackend *ab) {
 	LOG(Verbosity_VERBOSE, "Deinitializing audio backend\n");
 	ab->deinit(ab->ctx);
 
+	if (count_faults) {
+		uint64_t minor, major;
+		AudioBackend_faults(&minor, &major);
+		LOG(Verbosity_VERBOSE, "Audio thread page faults: %llu minor, %llu major\n", (unsigned long long)minor, (unsigned long long)major);
+	}
+
 	free(ab->ctx);
 }
 
@@ -54,3 +70,29 @@ void AudioBackend_unlock(AudioBackend *ab) {
 void AudioBackend_seek(AudioBackend *ab) {
 	ab->seek(ab->ctx);
 }
+
+// # of write callbacks per sample of the audio thread's page faults, so most callbacks don't make a system call
+#define AUDIOBACKEND_FAULTS_INTERVAL 64
+
+// Page faults taken by the audio thread, as of the last sample.
+// Only one backend is connected at a time, so these don't need to live in the AudioBackend.
+static _Atomic uint64_t audio_thread_minflt = 0;
+static _Atomic uint64_t audio_thread_majflt = 0;
+
+void AudioBackend_count_faults(void) {
+#ifdef RUSAGE_THREAD
+	static _Thread_local unsigned n_calls = 0;
+	if (!count_faults || n_calls++ % AUDIOBACKEND_FAULTS_INTERVAL != 0) {
+		return;
+	}
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		atomic_store_explicit(&audio_thread_minflt, usage.ru_minflt, memory_order_relaxed);
+		atomic_store_explicit(&audio_thread_majflt, usage.ru_majflt, memory_order_relaxed);
+	}
+#endif
+}
+void AudioBackend_faults(uint64_t *minor, uint64_t *major) {
+	*minor = atomic_load_explicit(&audio_thread_minflt, memory_order_relaxed);
+	*major = atomic_load_explicit(&audio_thread_majflt, memory_order_relaxed);
+}
@@ -6,6 +6,7 @@
 #include "error.h"
 #include "ui/event_queue.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -95,3 +96,11 @@ void AudioBackend_lock(AudioBackend *ab);
 void AudioBackend_unlock(AudioBackend *ab);
 // Invalidate anything the backend has buffered and read new data from playback_buffer
 void AudioBackend_seek(AudioBackend *ab);
+
+// Record the page faults taken so far by the calling thread.
+// Backends call this from their write callbacks, so the count reflects faults taken on the real-time audio thread.
+// To stay off the real-time path, it only samples the count every so many calls,
+// and only when settings->at_buffer_lock is set or verbose logging (which logs the count) is on.
+void AudioBackend_count_faults(void);
+// Get the # of minor and major page faults last recorded by AudioBackend_count_faults()
+void AudioBackend_faults(uint64_t *minor, uint64_t *major);
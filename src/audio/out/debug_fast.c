@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "error.h"
 
@@ -14,7 +15,6 @@
 #include "audio/track.h"
 #include "backend.h"
 #include "util/log.h"
-#include "util/minmax.h"
 
 // FAST backend context
 typedef struct Ctx {
@@ -32,13 +32,6 @@ typedef struct Ctx {
 	AudioBuffer *playback_buffer;
 	AudioBuffer *next_buffer;
 
-	// Audio transfer buffer for current and next audio track
-	// (FAST doesn't do rotate buffers on a queue, so we manage transfer bufs manually)
-	unsigned char *playback_tb;
-	size_t playback_tb_cap;
-	unsigned char *next_tb;
-	size_t next_tb_cap;
-
 	// Configuration from mpl.conf
 	const Settings *settings;
 } Ctx;
@@ -74,8 +67,9 @@ AudioBackend AB_FAST = {
 // Audio data write callback
 static void FastStream_write_cb_(FastStream *stream, size_t n_bytes, void *userdata);
 
-/* Transfer buffer management */
-static void realloc_buf(unsigned char **buf, size_t *buf_cap, size_t newsize);
+// Write up to n bytes from ctx->playback_buffer to ctx->stream without an intermediate transfer buffer.
+// Returns the number of bytes written, or -1 on error.
+static ssize_t stream_write(Ctx *ctx, size_t n);
 
 static enum AudioBackend_ERR init(void *ctx__, EventQueue *eq, const Settings *settings) {
 	Ctx *ctx = ctx__;
@@ -109,9 +103,6 @@ static void deinit(void *ctx__) {
 	FastStream_free(ctx->stream);
 	FastLoop_free(ctx->loop);
 	FastServer_free(ctx->server);
-	// Free transfer buffers
-	free(ctx->playback_tb);
-	free(ctx->next_tb);
 	// Disconnect the event queue
 	// (handled in EventQueue_free now)
 }
@@ -157,17 +148,13 @@ static enum AudioBackend_ERR prepare(void *ctx__, AudioTrack *t) {
 
 	// Connect and fill framebuffer
 	ctx->playback_buffer = t->buffer;
-	size_t tb_size = AudioBuffer_max_read(ctx->playback_buffer, -1, -1, false);
+	size_t tb_size = AudioBuffer_max_read(ctx->playback_buffer, false);
 	if (FastStream_begin_write(ctx->stream, &tb_size) != 0) {
 		DEINIT();
 		return AudioBackend_FB_WRITE_ERR;
 	}
 
-	realloc_buf(&ctx->playback_tb, &ctx->playback_tb_cap, tb_size);
-	unsigned char *tb = ctx->playback_tb;
-	tb_size = AudioBuffer_read(ctx->playback_buffer, tb, tb_size, false);
-
-	if (FastStream_write(ctx->stream, tb, tb_size) != 0) {
+	if (stream_write(ctx, tb_size) < 0) {
 		DEINIT();
 		return AudioBackend_FB_WRITE_ERR;
 	}
@@ -214,18 +201,14 @@ static void FastStream_write_cb_(FastStream *stream, size_t n_bytes, void *userd
 		return;
 	}
 
-	// Copy from track buffer to transfer buffer
-	size_t tb_size = MIN(n_bytes, AudioBuffer_max_read(ctx->playback_buffer, -1, -1, false));
-	realloc_buf(&ctx->playback_tb, &ctx->playback_tb_cap, tb_size);
-	unsigned char *tb = ctx->playback_tb;
-	tb_size = AudioBuffer_read(ctx->playback_buffer, tb, tb_size, false);
-	// Copy from transfer buffer to AB buffer
-	if (FastStream_write(ctx->stream, tb, tb_size) != 0) {
+	// Copy straight from the track buffer to the AB buffer
+	const ssize_t n_written = stream_write(ctx, n_bytes);
+	if (n_written < 0) {
 		LOG(Verbosity_NORMAL, "Error: FastStream_write failed in write callback\n");
 	}
 
 	// Compute number of frames read, send to main as a timecode
-	const size_t n_read = ctx->playback_buffer->n_read;
+	const size_t n_read = AudioBuffer_n_read(ctx->playback_buffer);
 	const size_t frame_size = ctx->playback_buffer->frame_size;
 	const EventBody_Timecode frames_read = n_read / frame_size;
 	const Event evt = {
@@ -234,7 +217,7 @@ static void FastStream_write_cb_(FastStream *stream, size_t n_bytes, void *userd
 		.body_inline = frames_read};
 	// Send timecode to the main thread
 	EventSubQueue_send(ctx->evt_sq, &evt, false);
-	if (tb_size == 0) {
+	if (n_written == 0) {
 		// Notify the main thread of track end
 		const Event end_evt = {
 			.event_type = mpl_TRACK_END,
@@ -243,10 +226,22 @@ static void FastStream_write_cb_(FastStream *stream, size_t n_bytes, void *userd
 	}
 }
 
-static void realloc_buf(unsigned char **buf, size_t *buf_cap, size_t newsize) {
-	if (newsize <= *buf_cap) {
-		return;
+static ssize_t stream_write(Ctx *ctx, size_t n) {
+	AudioBufferRegion regions[AUDIOBUFFER_N_REGIONS];
+	AudioBuffer_read_peek(ctx->playback_buffer, n, true, regions);
+
+	size_t n_written = 0;
+	for (size_t i = 0; i < AUDIOBUFFER_N_REGIONS; i++) {
+		if (regions[i].len == 0) {
+			continue;
+		}
+		if (FastStream_write(ctx->stream, regions[i].data, regions[i].len) != 0) {
+			AudioBuffer_read_consume(ctx->playback_buffer, n_written);
+			return -1;
+		}
+		n_written += regions[i].len;
 	}
-	*buf_cap = MAX(newsize, 2 * (*buf_cap));
-	*buf = realloc(*buf, *buf_cap);
+	AudioBuffer_read_consume(ctx->playback_buffer, n_written);
+
+	return n_written;
 }
@@ -342,7 +342,7 @@ static void pw_stream_write_cb_(void *ctx__) {
 	pw_stream_queue_buffer(ctx->stream, pw_buf);
 
 	// Compute and send timecode to the main thread
-	const size_t n_read = buf->n_read;
+	const size_t n_read = AudioBuffer_n_read(buf);
 	const EventBody_Timecode frames_read = n_read / frame_size;
 	const Event evt = {
 		.event_type = mpl_TIMECODE,
@@ -354,6 +354,8 @@ static void pw_stream_write_cb_(void *ctx__) {
 		// Drain what's left in the stream, then the drained callback will TRACK_END
 		pw_stream_flush(ctx->stream, true);
 	}
+
+	AudioBackend_count_faults();
 }
 
 
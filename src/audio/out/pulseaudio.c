@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
 #include <time.h>
 
 #include "audio/buffer.h"
@@ -86,6 +87,12 @@ static void pa_stream_state_cb_(pa_stream *stream, void *userdata);
 // Operation completion callback
 static void pa_stream_success_cb_(pa_stream *stream, int success, void *userdata);
 
+// Write up to n bytes from ctx->playback_buffer to ctx->stream without an intermediate transfer buffer.
+// The first region of data is written using seek_mode, and anything after it is written relative to that.
+//
+// Returns the number of bytes written, or -1 on error.
+static ssize_t stream_write(Ctx *ctx, size_t n, pa_seek_mode_t seek_mode);
+
 static enum AudioBackend_ERR init(void *userdata, EventQueue *eq, const Settings *settings) {
 	Ctx *ctx = userdata;
 
@@ -252,17 +259,8 @@ static enum AudioBackend_ERR prepare(void *ctx__, AudioTrack *t) {
 
 	// Connect playback buffer to framebuffer and fill framebuffer
 	ctx->playback_buffer = t->buffer;
-	void *tb; // Transfer buffer
-	size_t tb_size = (size_t)-1;
-	if (pa_stream_begin_write(ctx->stream, &tb, &tb_size) != 0) {
-		DEINIT();
-		return AudioBackend_FB_WRITE_ERR;
-	}
-	tb_size = AudioBuffer_read(ctx->playback_buffer, tb, tb_size, false);
-	if (pa_stream_write(ctx->stream, tb, tb_size, NULL, 0, PA_SEEK_RELATIVE) != 0) {
+	if (stream_write(ctx, pa_stream_writable_size(ctx->stream), PA_SEEK_RELATIVE) < 0) {
 		DEINIT();
-		fprintf(stderr, "fuck\n");
-		fprintf(stderr, "tb_size: %zu\n", tb_size);
 		return AudioBackend_FB_WRITE_ERR;
 	}
 #undef DEINIT
@@ -307,19 +305,20 @@ static void seek(void *ctx__) {
 
 	pa_threaded_mainloop_lock(ctx->loop);
 
-	void *tb; // Transfer buffer
-	size_t tb_size = AudioBuffer_max_read(ctx->playback_buffer, -1, -1, 0);
-	if (pa_stream_begin_write(ctx->stream, &tb, &tb_size) != 0 || tb == NULL) {
-		LOG(Verbosity_NORMAL, "Warning: failed to allocate PulseAudio framebuffer.\n");
-		return;
+	// Replace everything PA has buffered with what's now in the playback buffer, but only as much of it as PA asks for,
+	// so playback (and the timecodes we send) don't run ahead of what's audible.
+	// The writable size doesn't count the audio we're about to replace, so when PA's buffer is full, refill up to its target length
+	size_t n = pa_stream_writable_size(ctx->stream);
+	const pa_buffer_attr *attr = pa_stream_get_buffer_attr(ctx->stream);
+	if (attr && attr->tlength != (uint32_t)-1 && (n == (size_t)-1 || n < attr->tlength)) {
+		n = attr->tlength;
 	}
-	tb_size = AudioBuffer_read(ctx->playback_buffer, tb, tb_size, false);
-	if (pa_stream_write(ctx->stream, tb, tb_size, NULL, 0, PA_SEEK_RELATIVE_ON_READ) != 0) {
+	if (n == (size_t)-1 || stream_write(ctx, n, PA_SEEK_RELATIVE_ON_READ) < 0) {
 		LOG(Verbosity_NORMAL, "Error in PulseAudio seek\n");
 	}
 
 	// Compute number of frames read, send to main as a timecode
-	const size_t n_read = ctx->playback_buffer->n_read;
+	const size_t n_read = AudioBuffer_n_read(ctx->playback_buffer);
 	const size_t frame_size = ctx->playback_buffer->frame_size;
 	const EventBody_Timecode frames_read = n_read / frame_size;
 	const Event evt = {
@@ -378,19 +377,13 @@ static void pa_stream_write_cb_(pa_stream *stream, size_t n_bytes, void *userdat
 		return;
 	}
 
-	// Allocate destination buffer in PA server memory to minimize copying
-	void *tb; // Transfer buffer
-	size_t tb_size = n_bytes;
-	if (pa_stream_begin_write(ctx->stream, &tb, &tb_size) != 0 || tb == NULL) {
-		fprintf(stderr, "Warning: failed to populated PulseAudio framebuffer.\n");
-		return;
-	}
-	tb_size = AudioBuffer_read(ctx->playback_buffer, tb, tb_size, false);
-	if (pa_stream_write(ctx->stream, tb, tb_size, NULL, 0, PA_SEEK_RELATIVE) != 0) {
+	// Hand buffered audio straight to PA, which copies it into server memory
+	const ssize_t n_written = stream_write(ctx, n_bytes, PA_SEEK_RELATIVE);
+	if (n_written < 0) {
 		fprintf(stderr, "Error in write callback\n");
 	}
 	// Compute number of frames read, send to main as a timecode
-	const size_t n_read = ctx->playback_buffer->n_read;
+	const size_t n_read = AudioBuffer_n_read(ctx->playback_buffer);
 	const size_t frame_size = ctx->playback_buffer->frame_size;
 	const EventBody_Timecode frames_read = n_read / frame_size;
 	const Event evt = {
@@ -399,11 +392,35 @@ static void pa_stream_write_cb_(pa_stream *stream, size_t n_bytes, void *userdat
 		.body_inline = frames_read};
 	// Send timecode to the main thread
 	EventSubQueue_send(ctx->evt_sq, &evt, false);
-	if (tb_size == 0) {
+	if (n_written == 0) {
 		// Notify the main thread of track end
 		const Event end_evt = {
 			.event_type = mpl_TRACK_END,
 			.body_size = 0};
 		EventSubQueue_send(ctx->evt_sq, &end_evt, false);
 	}
+
+	AudioBackend_count_faults();
+}
+
+static ssize_t stream_write(Ctx *ctx, size_t n, pa_seek_mode_t seek_mode) {
+	AudioBufferRegion regions[AUDIOBUFFER_N_REGIONS];
+	AudioBuffer_read_peek(ctx->playback_buffer, n, true, regions);
+
+	// PA copies each region directly into server memory (we pass no free callback)
+	size_t n_written = 0;
+	for (size_t i = 0; i < AUDIOBUFFER_N_REGIONS; i++) {
+		if (regions[i].len == 0) {
+			continue;
+		}
+		if (pa_stream_write(ctx->stream, regions[i].data, regions[i].len, NULL, 0, seek_mode) != 0) {
+			AudioBuffer_read_consume(ctx->playback_buffer, n_written);
+			return -1;
+		}
+		n_written += regions[i].len;
+		seek_mode = PA_SEEK_RELATIVE;
+	}
+	AudioBuffer_read_consume(ctx->playback_buffer, n_written);
+
+	return n_written;
 }
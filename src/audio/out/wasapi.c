@@ -300,7 +300,7 @@ static enum AudioBackend_ERR prepare(void *ctx__, AudioTrack *t) {
 
 	// Figure out how many frames we can actually write
 	const size_t frame_size = ctx->playback_buffer->frame_size;
-	uint32_t frame_count = AudioBuffer_max_read(ctx->playback_buffer, -1, -1, true) / frame_size;
+	uint32_t frame_count = AudioBuffer_max_read(ctx->playback_buffer, true) / frame_size;
 	if (frame_count > max_frame_count) {
 		frame_count = max_frame_count;
 	}
@@ -359,7 +359,7 @@ static void wasapi_write_cb_(void *userdata) {
 	}
 	// Figure out how many frames we can actually write,
 	const size_t frame_size = ctx->playback_buffer->frame_size;
-	uint32_t frame_count = AudioBuffer_max_read(ctx->playback_buffer, -1, -1, true) / frame_size;
+	uint32_t frame_count = AudioBuffer_max_read(ctx->playback_buffer, true) / frame_size;
 	if (frame_count > max_frame_count) {
 		frame_count = max_frame_count;
 	}
@@ -387,7 +387,7 @@ static void wasapi_write_cb_(void *userdata) {
 	}
 
 	// Compute number of frames read, send to main as a timecode
-	const size_t n_read = ctx->playback_buffer->n_read;
+	const size_t n_read = AudioBuffer_n_read(ctx->playback_buffer);
 	const EventBody_Timecode frames_read = n_read / frame_size;
 	const Event evt = {
 		.event_type = mpl_TIMECODE,
@@ -0,0 +1,88 @@
+#include "packet_queue.h"
+
+#include <libavutil/avutil.h>
+#include <stdlib.h>
+#include <string.h>
+
+void PacketQueue_init(PacketQueue *q) {
+	memset(q, 0, sizeof(PacketQueue));
+	q->last_pts = AV_NOPTS_VALUE;
+}
+
+void PacketQueue_deinit(PacketQueue *q) {
+	for (size_t i = 0; i < q->cap; i++) {
+		av_packet_free(&q->pkts[i]);
+	}
+	free(q->pkts);
+	memset(q, 0, sizeof(PacketQueue));
+}
+
+// Double q's capacity, unwrapping its contents to the start of the new array
+static int PacketQueue_grow(PacketQueue *q) {
+	const size_t cap = q->cap ? q->cap * 2 : 64;
+	AVPacket **pkts = calloc(cap, sizeof(AVPacket *));
+	if (!pkts) {
+		return 1;
+	}
+	for (size_t i = 0; i < q->cap; i++) {
+		pkts[i] = q->pkts[(q->head + i) % q->cap];
+	}
+	free(q->pkts);
+	q->pkts = pkts;
+	q->cap = cap;
+	q->head = 0;
+	return 0;
+}
+
+AVPacket *PacketQueue_reserve(PacketQueue *q) {
+	if (q->len == q->cap && PacketQueue_grow(q) != 0) {
+		return NULL;
+	}
+
+	AVPacket **slot = &q->pkts[(q->head + q->len) % q->cap];
+	if (!*slot) {
+		*slot = av_packet_alloc();
+	}
+	return *slot;
+}
+
+void PacketQueue_commit(PacketQueue *q) {
+	const AVPacket *pkt = q->pkts[(q->head + q->len) % q->cap];
+	q->last_pts = pkt->pts;
+	q->bytes += pkt->size;
+	q->len++;
+}
+
+bool PacketQueue_pop(PacketQueue *q, AVPacket *dst) {
+	if (q->len == 0) {
+		return false;
+	}
+
+	q->bytes -= q->pkts[q->head]->size;
+	av_packet_move_ref(dst, q->pkts[q->head]);
+	q->head = (q->head + 1) % q->cap;
+	q->len--;
+	return true;
+}
+
+void PacketQueue_clear(PacketQueue *q) {
+	for (; q->len > 0; q->len--) {
+		av_packet_unref(q->pkts[q->head]);
+		q->head = (q->head + 1) % q->cap;
+	}
+	q->last_pts = AV_NOPTS_VALUE;
+	q->bytes = 0;
+	q->eof = false;
+	q->eof_status = 0;
+}
+
+int64_t PacketQueue_ahead(const PacketQueue *q) {
+	if (q->len == 0) {
+		return 0;
+	}
+	const int64_t first_pts = q->pkts[q->head]->pts;
+	if (first_pts == AV_NOPTS_VALUE || q->last_pts == AV_NOPTS_VALUE) {
+		return 0;
+	}
+	return q->last_pts - first_pts;
+}
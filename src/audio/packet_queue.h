@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libavcodec/packet.h>
+
+// A FIFO of compressed packets read ahead of decoding.
+// Packet structs are kept around once allocated, so a queue that's stopped growing never allocates.
+// NOTE: not thread-safe. A PacketQueue belongs to whichever thread is decoding its track.
+typedef struct PacketQueue {
+	AVPacket **pkts; // Circular array of cap packets, of which len starting at head hold data
+	size_t cap, head, len;
+
+	int64_t last_pts; // pts of the last packet pushed (in stream time_base units), or AV_NOPTS_VALUE
+	size_t bytes; // Total size of the queued packets' data
+	size_t max_bytes; // Size of packet data we're allowed to queue, 0 for no limit
+
+	// Set once the demuxer has nothing more to give us, along with the averror it returned
+	bool eof;
+	int eof_status;
+} PacketQueue;
+
+// Initialize an empty PacketQueue
+void PacketQueue_init(PacketQueue *q);
+// Deinitialize a PacketQueue for freeing
+void PacketQueue_deinit(PacketQueue *q);
+
+// Reserve a blank packet at the back of *q for the caller to read into.
+// Returns NULL on allocation failure.
+AVPacket *PacketQueue_reserve(PacketQueue *q);
+// Add the packet returned by the last PacketQueue_reserve() call to the back of *q
+void PacketQueue_commit(PacketQueue *q);
+// Move the packet at the front of *q into *dst (which must be blank).
+// Returns whether there was a packet to move.
+bool PacketQueue_pop(PacketQueue *q, AVPacket *dst);
+// Drop every queued packet and clear *q's EOF state (i.e after a seek)
+void PacketQueue_clear(PacketQueue *q);
+
+// Return whether *q holds as much packet data as it's allowed to
+static inline bool PacketQueue_full(const PacketQueue *q) {
+	return q->max_bytes && q->bytes >= q->max_bytes;
+}
+// Return how far ahead (in stream time_base units) the queued packets reach, or 0 if that isn't known
+int64_t PacketQueue_ahead(const PacketQueue *q);
@@ -0,0 +1,244 @@
+#include "seek_index.h"
+#include "error.h"
+#include "util/log.h"
+#include "util/path.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef __WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Header of an on-disk SeekIndex, followed by the track's url and then its entries
+struct SeekIndexFileHeader {
+	char magic[8];
+	int64_t mtime;
+	int64_t size;
+	int64_t interval;
+	uint64_t url_len;
+	uint64_t len;
+};
+static const char SEEKINDEX_MAGIC[8] = {'M', 'P', 'L', 'S', 'I', 'D', 'X', '1'};
+
+int SeekIndex_init(SeekIndex *idx, const char *url, int64_t interval) {
+	memset(idx, 0, sizeof(SeekIndex));
+	idx->interval = interval;
+	idx->contiguous = true;
+	idx->scanned_end = -1;
+
+	idx->url = strdup(url);
+	CHECK_ALLOC(idx->url, 1);
+
+	return 0;
+}
+
+void SeekIndex_deinit(SeekIndex *idx) {
+	free(idx->entries);
+	idx->entries = NULL;
+	idx->len = idx->cap = 0;
+	free(idx->url);
+	idx->url = NULL;
+}
+
+void SeekIndex_note(SeekIndex *idx, int64_t pos, int64_t frame) {
+	// Only packets read contiguously from track start are indexed, which keeps entries sorted and gapless
+	if (idx->complete || !idx->contiguous || pos < 0 || frame <= idx->scanned_end) {
+		return;
+	}
+	idx->scanned_end = frame;
+
+	if (idx->len > 0 && frame - idx->entries[idx->len-1].frame < idx->interval) {
+		return;
+	}
+	if (idx->len == idx->cap) {
+		const size_t cap = idx->cap ? idx->cap * 2 : 256;
+		SeekIndexEntry *entries = realloc(idx->entries, cap * sizeof(SeekIndexEntry));
+		if (!entries) {
+			// Stop indexing, the index we have is still valid
+			idx->contiguous = false;
+			return;
+		}
+		idx->entries = entries;
+		idx->cap = cap;
+	}
+	idx->entries[idx->len++] = (SeekIndexEntry){.pos = pos, .frame = frame};
+}
+
+void SeekIndex_jump(SeekIndex *idx, int64_t frame) {
+	// We can only keep indexing if we've jumped somewhere we've already scanned
+	idx->contiguous = frame >= 0 && frame <= idx->scanned_end;
+}
+
+// Get the path *idx is cached at, allocated using malloc. Returns NULL if there's no cache directory.
+static char *SeekIndex_cache_path(const SeekIndex *idx) {
+	// Name the cache file after an FNV-1a hash of the track's path
+	uint64_t hash = 0xcbf29ce484222325;
+	for (const char *c = idx->url; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 0x100000001b3;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.idx", (unsigned long long)hash);
+
+	// $XDG_CACHE_HOME/mpl/seek/ (see path_cache())
+	char *path;
+	size_t path_len;
+	const char *parts[] = {"seek", name};
+	if (path_cache(&path, &path_len, parts, sizeof(parts) / sizeof(parts[0])) != 0) {
+		return NULL;
+	}
+	return path;
+}
+
+#ifndef __WIN32
+// Fill in the parts of *hdr that identify the current version of the track file
+static int SeekIndex_file_id(const SeekIndex *idx, struct SeekIndexFileHeader *hdr) {
+	const char *file = path_from_url(idx->url);
+	struct stat st;
+	if (!file || stat(file, &st) != 0) {
+		return 1;
+	}
+	memcpy(hdr->magic, SEEKINDEX_MAGIC, sizeof(SEEKINDEX_MAGIC));
+	hdr->mtime = st.st_mtime;
+	hdr->size = st.st_size;
+	hdr->url_len = strlen(idx->url);
+	return 0;
+}
+#endif
+
+int SeekIndex_load(SeekIndex *idx) {
+	idx->cache = true;
+	if (idx->complete) {
+		return 0;
+	}
+#ifdef __WIN32
+	return 1;
+#else
+	struct SeekIndexFileHeader id, hdr;
+	if (SeekIndex_file_id(idx, &id) != 0) {
+		// Not a local file
+		idx->cache = false;
+		return 1;
+	}
+
+	char *path = SeekIndex_cache_path(idx);
+	if (!path) {
+		idx->cache = false;
+		return 1;
+	}
+	FILE *fp = fopen(path, "rb");
+	free(path);
+	if (!fp) {
+		return 1;
+	}
+
+	// Only use the cached index if it was built for this exact version of the track
+	int status = 1;
+	char *url = NULL;
+	SeekIndexEntry *entries = NULL;
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+			|| memcmp(hdr.magic, id.magic, sizeof(hdr.magic)) != 0
+			|| hdr.mtime != id.mtime || hdr.size != id.size
+			|| hdr.interval != idx->interval || hdr.url_len != id.url_len
+			|| hdr.len == 0) {
+		goto out;
+	}
+	url = malloc(hdr.url_len);
+	entries = malloc(hdr.len * sizeof(SeekIndexEntry));
+	if (!url || !entries
+			|| fread(url, 1, hdr.url_len, fp) != hdr.url_len
+			|| memcmp(url, idx->url, hdr.url_len) != 0
+			|| fread(entries, sizeof(SeekIndexEntry), hdr.len, fp) != hdr.len) {
+		goto out;
+	}
+
+	free(idx->entries);
+	idx->entries = entries;
+	entries = NULL;
+	idx->len = idx->cap = hdr.len;
+	idx->scanned_end = idx->entries[idx->len-1].frame;
+	idx->complete = true;
+	LOG(Verbosity_DEBUG, "Loaded seek index for %s (%zu entries)\n", idx->url, idx->len);
+	status = 0;
+
+out:
+	free(url);
+	free(entries);
+	fclose(fp);
+	return status;
+#endif
+}
+
+// Save a complete index to disk
+static void SeekIndex_save(const SeekIndex *idx) {
+#ifndef __WIN32
+	struct SeekIndexFileHeader hdr;
+	if (SeekIndex_file_id(idx, &hdr) != 0) {
+		return;
+	}
+	hdr.interval = idx->interval;
+	hdr.len = idx->len;
+
+	char *path = SeekIndex_cache_path(idx);
+	if (!path) {
+		return;
+	}
+	path_mkdir_parents(path);
+
+	// Write to a temporary file of our own and move it into place, so a concurrent load never sees a partial index
+	// (and mpl instances saving the same index at once don't write into each other's)
+	const size_t path_len = strlen(path);
+	char tmp_path[path_len + sizeof(".XXXXXX")];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+	const int fd = mkstemp(tmp_path);
+	FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!fp) {
+		LOG(Verbosity_DEBUG, "Failed to open %s for writing\n", tmp_path);
+		if (fd >= 0) {
+			close(fd);
+			remove(tmp_path);
+		}
+		free(path);
+		return;
+	}
+	const bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(idx->url, 1, hdr.url_len, fp) == hdr.url_len
+		&& fwrite(idx->entries, sizeof(SeekIndexEntry), idx->len, fp) == idx->len;
+	if (fclose(fp) == 0 && ok && rename(tmp_path, path) == 0) {
+		LOG(Verbosity_DEBUG, "Saved seek index for %s to %s\n", idx->url, path);
+	} else {
+		remove(tmp_path);
+	}
+	free(path);
+#endif
+}
+
+void SeekIndex_finish(SeekIndex *idx) {
+	if (idx->complete || !idx->contiguous || idx->len == 0) {
+		return;
+	}
+	idx->complete = true;
+	if (idx->cache) {
+		SeekIndex_save(idx);
+	}
+}
+
+const SeekIndexEntry *SeekIndex_find(const SeekIndex *idx, int64_t frame) {
+	// Binary search for the first entry after frame
+	size_t lo = 0, hi = idx->len;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].frame <= frame) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo > 0 ? &idx->entries[lo-1] : NULL;
+}
+
+bool SeekIndex_covers(const SeekIndex *idx, int64_t frame) {
+	return idx->len > 0 && (idx->complete || frame <= idx->scanned_end);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A seek point: the byte position of a packet in a track's file, and the sample frame decoding it starts at
+typedef struct SeekIndexEntry {
+	int64_t pos;
+	int64_t frame;
+} SeekIndexEntry;
+
+// An index of seek points for a single track, ordered by frame.
+// It's built up while buffering, and (once it covers the whole track) cached on disk keyed by the track's path + mtime.
+typedef struct SeekIndex {
+	SeekIndexEntry *entries;
+	size_t len, cap;
+	int64_t interval; // Minimum # of sample frames between entries
+
+	// Indexing state
+	// Whether every packet from track start up to scanned_end has been read without any jumps.
+	// Only a contiguous index can be marked complete.
+	bool contiguous;
+	int64_t scanned_end; // Frame of the last packet seen while contiguous, or -1
+	bool complete; // Whether the index covers the whole track, in which case no more entries are added
+
+	// Disk caching
+	char *url; // Path of the indexed track
+	bool cache; // Whether to save the index to disk once it's complete
+} SeekIndex;
+
+// Initialize an empty SeekIndex for the track at *url, spacing entries at least interval sample frames apart
+int SeekIndex_init(SeekIndex *idx, const char *url, int64_t interval);
+// Deinitialize a SeekIndex for freeing
+void SeekIndex_deinit(SeekIndex *idx);
+
+// Note that the packet at byte position pos starts at sample frame #frame.
+// Packets must be noted in the order they're read. This does nothing once the index is complete.
+void SeekIndex_note(SeekIndex *idx, int64_t pos, int64_t frame);
+// Note that reading jumped to the packet starting at sample frame #frame (i.e after a seek).
+// Pass -1 if the frame isn't known.
+void SeekIndex_jump(SeekIndex *idx, int64_t frame);
+// Note that the track has been read up to EOF, completing the index if it's contiguous (and saving it to disk if enabled)
+void SeekIndex_finish(SeekIndex *idx);
+
+// Return the last entry at or before frame, or NULL if there isn't one
+const SeekIndexEntry *SeekIndex_find(const SeekIndex *idx, int64_t frame);
+// Return whether *idx can be used to seek to frame, i.e it has been scanned (contiguously) up to frame
+bool SeekIndex_covers(const SeekIndex *idx, int64_t frame);
+
+// Enable disk caching for *idx, loading a previously cached (complete) index if one matches the track's path + mtime.
+// Returns 0 if a cached index was loaded.
+int SeekIndex_load(SeekIndex *idx);
@@ -0,0 +1,403 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+
+#include "segment.h"
+#include "track.h"
+#include "../error.h"
+#include "audio/buffer.h"
+#include "audio/io.h"
+#include "util/log.h"
+
+
+// A worker's decoding state, and the segment it's been handed
+typedef struct SegmentWorker {
+	pthread_t thread;
+	bool started; // Whether thread is running. If it isn't, the worker's segments are decoded by the caller
+	bool busy; // Whether the worker has been handed a segment it hasn't finished decoding yet
+	SegmentDecoder *sd;
+
+	// Decoding
+	AVFormatContext *avf_ctx;
+	AudioIO *io;
+	AVCodecContext *avc_ctx;
+	AVPacket *av_packet;
+	AVFrame *av_frame;
+	unsigned char *straddle; // A frame straddling the end of the buffer, on its way into it
+	unsigned int straddle_size;
+
+	// Segment
+	const AudioTrack *track;
+	uint64_t start, end; // Sample frames [start, end) to decode
+	uint64_t n_frames; // # of frames decoded contiguously from start
+} SegmentWorker;
+
+struct SegmentDecoder {
+	SegmentWorker *workers;
+	size_t n_workers;
+	bool opened; // Whether the workers' decoding state has been set up
+	bool failed; // Whether setting it up failed, in which case we don't try again
+	const Settings *settings;
+	atomic_bool cancel;
+
+	// Worker threads are started along with the workers' decoding state, and wait on work until they're handed a segment
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done; // Signaled when a worker finishes its segment
+	bool quit; // Whether the worker threads should exit
+};
+
+SegmentDecoder *SegmentDecoder_new(size_t n_workers, const Settings *settings) {
+	SegmentDecoder *sd = malloc(sizeof(SegmentDecoder));
+	CHECK_ALLOC(sd, NULL);
+	memset(sd, 0, sizeof(SegmentDecoder));
+
+	sd->workers = calloc(n_workers, sizeof(SegmentWorker));
+	if (!sd->workers) {
+		free(sd);
+		return NULL;
+	}
+	sd->n_workers = n_workers;
+	sd->settings = settings;
+	for (size_t i = 0; i < n_workers; i++) {
+		sd->workers[i].sd = sd;
+	}
+	atomic_init(&sd->cancel, false);
+	pthread_mutex_init(&sd->mutex, NULL);
+	pthread_cond_init(&sd->work, NULL);
+	pthread_cond_init(&sd->done, NULL);
+
+	return sd;
+}
+
+// Free a worker's decoding state
+static void SegmentWorker_close(SegmentWorker *w) {
+	av_packet_free(&w->av_packet);
+	av_frame_free(&w->av_frame);
+	avcodec_free_context(&w->avc_ctx);
+	AudioIO_close_input(&w->avf_ctx, &w->io);
+	av_freep(&w->straddle);
+	w->straddle_size = 0;
+}
+
+void SegmentDecoder_free(SegmentDecoder *sd) {
+	// Stop the worker threads
+	pthread_mutex_lock(&sd->mutex);
+	sd->quit = true;
+	pthread_cond_broadcast(&sd->work);
+	pthread_mutex_unlock(&sd->mutex);
+	for (size_t i = 0; i < sd->n_workers; i++) {
+		if (sd->workers[i].started) {
+			pthread_join(sd->workers[i].thread, NULL);
+		}
+	}
+
+	for (size_t i = 0; i < sd->n_workers; i++) {
+		SegmentWorker_close(&sd->workers[i]);
+	}
+	pthread_cond_destroy(&sd->done);
+	pthread_cond_destroy(&sd->work);
+	pthread_mutex_destroy(&sd->mutex);
+	free(sd->workers);
+	free(sd);
+}
+
+// Open a demuxer + decoder for worker *w, mirroring those of *t
+//
+// Return value is an averror
+static int SegmentWorker_open(SegmentWorker *w, const AudioTrack *t) {
+	// Open the track again, since demuxers can't be shared between threads
+	// (sharing the track's file contents, if they're held in memory)
+	int status = AudioIO_open_input(&w->avf_ctx, &w->io, t->avf_ctx->url, w->sd->settings, AudioIO_file_data(t->io));
+	if (status < 0) {
+		return status;
+	}
+	if ((unsigned int)t->stream_no >= w->avf_ctx->nb_streams) {
+		return AVERROR_STREAM_NOT_FOUND;
+	}
+	// Only read the stream we're decoding
+	for (unsigned int i = 0; i < w->avf_ctx->nb_streams; i++) {
+		if (i != (unsigned int)t->stream_no) {
+			w->avf_ctx->streams[i]->discard = AVDISCARD_ALL;
+		}
+	}
+
+	w->avc_ctx = avcodec_alloc_context3(t->codec);
+	if (w->avc_ctx == NULL) {
+		return AVERROR(ENOMEM);
+	}
+	status = avcodec_parameters_to_context(w->avc_ctx, t->avf_ctx->streams[t->stream_no]->codecpar);
+	if (status < 0) {
+		return status;
+	}
+	// Workers are already one thread each
+	w->avc_ctx->thread_count = 1;
+	status = avcodec_open2(w->avc_ctx, t->codec, NULL);
+	if (status < 0) {
+		return status;
+	}
+
+	w->av_packet = av_packet_alloc();
+	w->av_frame = av_frame_alloc();
+	if (w->av_packet == NULL || w->av_frame == NULL) {
+		return AVERROR(ENOMEM);
+	}
+	return 0;
+}
+
+// Get the timestamp (in stream time_base units) of the start of t's audio stream
+static int64_t SegmentWorker_start_ts(const AudioTrack *t) {
+	const AVStream *stream = t->avf_ctx->streams[t->stream_no];
+	return stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+}
+
+// Seek w's demuxer to the nearest seek point before its segment, leaving the decoder some preroll (see AudioTrack_seek_preroll()).
+// Sets *frame to the sample frame decoding resumes at, or -1 if that's only known once a packet has been read.
+//
+// Return value is an averror
+static int SegmentWorker_seek(SegmentWorker *w, int64_t *frame) {
+	const AudioTrack *t = w->track;
+	const uint64_t preroll = AudioTrack_seek_preroll(t);
+	const int64_t preroll_start = w->start > preroll ? w->start - preroll : 0;
+
+	const SeekIndexEntry *entry = NULL;
+	if (t->byte_seek && SeekIndex_covers(&t->seek_index, w->start)) {
+		entry = SeekIndex_find(&t->seek_index, preroll_start);
+		if (!entry) {
+			entry = SeekIndex_find(&t->seek_index, w->start);
+		}
+	}
+
+	int status;
+	if (entry) {
+		*frame = entry->frame;
+		status = av_seek_frame(w->avf_ctx, t->stream_no, entry->pos, AVSEEK_FLAG_BYTE);
+	} else {
+		*frame = -1;
+		const AVRational frame_tb = {1, t->buf_pcm.sample_rate};
+		const int64_t ts = SegmentWorker_start_ts(t) + av_rescale_q(preroll_start, frame_tb, w->avf_ctx->streams[t->stream_no]->time_base);
+		status = av_seek_frame(w->avf_ctx, t->stream_no, ts, AVSEEK_FLAG_BACKWARD);
+	}
+	avcodec_flush_buffers(w->avc_ctx);
+
+	return status;
+}
+
+// Write the part of w->av_frame (starting at sample frame pos) that falls within w's segment into the track's buffer.
+// Returns false if the frame leaves a gap after what's been decoded so far, i.e the seek landed past the segment's start.
+static bool SegmentWorker_write_frame(SegmentWorker *w, int64_t pos) {
+	const AudioTrack *t = w->track;
+	AudioBuffer *buf = t->buffer;
+	const AVFrame *frame = w->av_frame;
+
+	const int64_t next = w->start + w->n_frames; // First frame we still need
+	if (pos > next) {
+		return false;
+	}
+	const int64_t lo = next;
+	const int64_t hi = pos + frame->nb_samples < (int64_t)w->end ? pos + frame->nb_samples : (int64_t)w->end;
+	if (hi <= lo) {
+		// Preroll, or past our segment
+		return true;
+	}
+
+	// Convert straight into the buffer. Only a frame straddling the end of a non-mirrored buffer goes through scratch space
+	for (int64_t f = lo; f < hi;) {
+		unsigned char *dst;
+		size_t len;
+		AudioBuffer_write_reserve_at(buf, f * buf->frame_size, (hi - f) * buf->frame_size, &dst, &len);
+		if (len == 0) {
+			av_fast_malloc(&w->straddle, &w->straddle_size, buf->frame_size);
+			if (!w->straddle) {
+				return false;
+			}
+			t->write_frames(w->straddle, (const uint8_t *const *)frame->extended_data, f - pos, 1, t->buf_pcm.n_channels);
+			AudioBuffer_write_at(buf, f * buf->frame_size, w->straddle, buf->frame_size);
+			f++;
+		} else {
+			t->write_frames(dst, (const uint8_t *const *)frame->extended_data, f - pos, len / buf->frame_size, t->buf_pcm.n_channels);
+			f += len / buf->frame_size;
+		}
+		w->n_frames = f - w->start;
+	}
+
+	return true;
+}
+
+// Decode w's segment into its track's buffer, setting w->n_frames to the # of frames decoded
+static void SegmentWorker_decode(SegmentWorker *w) {
+	const AudioTrack *t = w->track;
+	const AVRational frame_tb = {1, t->buf_pcm.sample_rate};
+	const AVRational time_base = w->avf_ctx->streams[t->stream_no]->time_base;
+
+	w->n_frames = 0;
+	int64_t pos; // Sample frame the next decoded frame starts at
+	if (SegmentWorker_seek(w, &pos) < 0) {
+		return;
+	}
+
+	bool ok = true;
+	bool eof = false;
+	while (ok && !eof && w->start + w->n_frames < w->end && !atomic_load_explicit(&w->sd->cancel, memory_order_relaxed)) {
+		// Read the next packet of our stream, flushing the decoder once there are none left
+		int status;
+		do {
+			av_packet_unref(w->av_packet);
+			status = av_read_frame(w->avf_ctx, w->av_packet);
+		} while (status >= 0 && w->av_packet->stream_index != t->stream_no);
+		if (status < 0) {
+			av_packet_unref(w->av_packet);
+			if (status != AVERROR_EOF) {
+				break;
+			}
+			eof = true;
+		}
+
+		// Decoded frames can only be placed once we know where the first packet starts
+		if (pos < 0) {
+			if (eof || w->av_packet->pts == AV_NOPTS_VALUE) {
+				break;
+			}
+			pos = av_rescale_q(w->av_packet->pts - SegmentWorker_start_ts(t), time_base, frame_tb);
+		}
+
+		status = avcodec_send_packet(w->avc_ctx, eof ? NULL : w->av_packet);
+		av_packet_unref(w->av_packet);
+		if (status < 0) {
+			break;
+		}
+		while (ok && avcodec_receive_frame(w->avc_ctx, w->av_frame) >= 0) {
+			ok = SegmentWorker_write_frame(w, pos);
+			pos += w->av_frame->nb_samples;
+			av_frame_unref(w->av_frame);
+		}
+	}
+}
+
+// Decode each segment w is handed, until the SegmentDecoder is freed
+static void *SegmentWorker_routine(void *args) {
+	SegmentWorker *w = args;
+	SegmentDecoder *sd = w->sd;
+
+	pthread_mutex_lock(&sd->mutex);
+	while (true) {
+		while (!w->busy && !sd->quit) {
+			pthread_cond_wait(&sd->work, &sd->mutex);
+		}
+		if (sd->quit) {
+			break;
+		}
+		pthread_mutex_unlock(&sd->mutex);
+
+		SegmentWorker_decode(w);
+
+		pthread_mutex_lock(&sd->mutex);
+		w->busy = false;
+		pthread_cond_signal(&sd->done);
+	}
+	pthread_mutex_unlock(&sd->mutex);
+
+	return NULL;
+}
+
+// Set up every worker's decoding state for *t and start their threads, if that isn't already done.
+// Returns whether the workers are ready to decode.
+static bool SegmentDecoder_open(SegmentDecoder *sd, const AudioTrack *t) {
+	char av_err[AV_ERROR_MAX_STRING_SIZE]; // libav* library error message buffer
+
+	if (sd->opened || sd->failed) {
+		return sd->opened;
+	}
+	for (size_t i = 0; i < sd->n_workers; i++) {
+		const int status = SegmentWorker_open(&sd->workers[i], t);
+		if (status < 0) {
+			av_perror(status, av_err);
+			LOG(Verbosity_VERBOSE, "Unable to set up segment decoding, falling back to sequential decoding\n");
+			for (size_t j = 0; j <= i; j++) {
+				SegmentWorker_close(&sd->workers[j]);
+			}
+			sd->failed = true;
+			return false;
+		}
+	}
+	// Start a thread per worker, except for the first, whose segments the caller decodes itself
+	for (size_t i = 1; i < sd->n_workers; i++) {
+		sd->workers[i].started = pthread_create(&sd->workers[i].thread, NULL, SegmentWorker_routine, &sd->workers[i]) == 0;
+	}
+	sd->opened = true;
+	return true;
+}
+
+uint64_t SegmentDecoder_decode(SegmentDecoder *sd, const AudioTrack *t, uint64_t first, uint64_t last, uint64_t min_frames) {
+	if (last <= first || !SegmentDecoder_open(sd, t)) {
+		return 0;
+	}
+
+	// Use as many workers as we have, as long as each segment is at least min_frames long
+	size_t n_segments = (last - first) / (min_frames ? min_frames : 1);
+	if (n_segments > sd->n_workers) {
+		n_segments = sd->n_workers;
+	} else if (n_segments == 0) {
+		n_segments = 1;
+	}
+	for (size_t i = 0; i < n_segments; i++) {
+		SegmentWorker *w = &sd->workers[i];
+		w->track = t;
+		w->start = first + (last - first) * i / n_segments;
+		w->end = first + (last - first) * (i + 1) / n_segments;
+		w->n_frames = 0;
+	}
+
+	// Hand the segments to the worker threads, except for the first, which we decode ourselves
+	// (along with those of any workers whose thread couldn't be started)
+	pthread_mutex_lock(&sd->mutex);
+	for (size_t i = 1; i < n_segments; i++) {
+		sd->workers[i].busy = sd->workers[i].started;
+	}
+	pthread_cond_broadcast(&sd->work);
+	pthread_mutex_unlock(&sd->mutex);
+	SegmentWorker_decode(&sd->workers[0]);
+	for (size_t i = 1; i < n_segments; i++) {
+		if (!sd->workers[i].started) {
+			SegmentWorker_decode(&sd->workers[i]);
+		}
+	}
+	pthread_mutex_lock(&sd->mutex);
+	for (size_t i = 1; i < n_segments; i++) {
+		while (sd->workers[i].busy) {
+			pthread_cond_wait(&sd->done, &sd->mutex);
+		}
+	}
+	pthread_mutex_unlock(&sd->mutex);
+
+	// Frames are only usable up to the end of the first segment that came up short
+	uint64_t n_frames = 0;
+	for (size_t i = 0; i < n_segments; i++) {
+		const SegmentWorker *w = &sd->workers[i];
+		n_frames += w->n_frames;
+		if (w->n_frames < w->end - w->start) {
+			break;
+		}
+	}
+	LOG(Verbosity_DEBUG, "Decoded %llu frames in %zu segments\n", (unsigned long long)n_frames, n_segments);
+
+	return n_frames;
+}
+
+void SegmentDecoder_cancel(SegmentDecoder *sd) {
+	atomic_store(&sd->cancel, true);
+}
+
+void SegmentDecoder_reset_cancel(SegmentDecoder *sd) {
+	atomic_store(&sd->cancel, false);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "config/settings.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct AudioTrack AudioTrack; // break circular dependency between AudioTrack and SegmentDecoder
+
+// Decodes a range of a track in parallel: the range is split into segments, each decoded by a worker thread
+// with its own demuxer + decoder, straight into the track's AudioBuffer.
+// Workers open their demuxers and start their threads the first time they're needed,
+// and keep them for later ranges of the same track.
+typedef struct SegmentDecoder SegmentDecoder;
+
+// Create a SegmentDecoder with n_workers worker threads (including the calling thread), whose demuxers read files as
+// *settings configures (see AudioIO). Returns NULL on allocation failure.
+SegmentDecoder *SegmentDecoder_new(size_t n_workers, const Settings *settings);
+// Free a SegmentDecoder and every worker's decoding state
+void SegmentDecoder_free(SegmentDecoder *sd);
+
+// Decode sample frames [first, last) of *t into t->buffer, splitting them into segments of at least min_frames frames.
+// Each segment starts at a seek point from t's seek index when it covers the segment, and from a demuxer seek otherwise,
+// so the caller must make sure demuxer seeks are exact when the index doesn't cover [first, last).
+// Nothing is committed: the caller commits the returned # of frames, which were decoded contiguously from first on
+// (fewer than asked for if a segment hit EOF, failed, or decoding was cancelled).
+// NOTE: t's own demuxer + decoder aren't touched, but nothing else may write to t->buffer meanwhile
+uint64_t SegmentDecoder_decode(SegmentDecoder *sd, const AudioTrack *t, uint64_t first, uint64_t last, uint64_t min_frames);
+// Make a SegmentDecoder_decode() call in progress (or the next one, if none is) return early,
+// and every later one until SegmentDecoder_reset_cancel() is called.
+// Safe to call from any thread.
+void SegmentDecoder_cancel(SegmentDecoder *sd);
+// Let SegmentDecoder_decode() calls run to completion again after SegmentDecoder_cancel()
+void SegmentDecoder_reset_cancel(SegmentDecoder *sd);
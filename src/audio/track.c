@@ -18,6 +18,7 @@
 #include <libavformat/avformat.h>
 #include <libavcodec/codec.h>
 #include <libavutil/dict.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,16 +38,44 @@
 #include "util/rational.h"
 #include "util/log.h"
 #include "util/compat/string_win32.h"
+#ifdef MPL_MEM_DEBUG
+#include "util/alloc_count.h"
+#endif
+
 
+// # of seek index entries per second of audio
+static const int64_t SEEK_INDEX_RATE = 2;
+// Max # of packets to read ahead, for streams whose packets don't tell us how far ahead we are
+static const size_t PACKET_AHEAD_MAX = 1 << 14;
+// Min # of milliseconds of preroll to leave the decoder before a seek target, for codecs whose packet size varies (or is larger)
+static const uint32_t SEEK_PREROLL_MIN_MS = 50;
+// Min # of seconds of audio per segment decoded in parallel, below which a segment isn't worth a thread
+static const uint64_t SEGMENT_MIN_SECONDS = 1;
+// Demuxers whose seeks land exactly on the packet holding a timestamp, and which give every packet an exact timestamp
+static const char *const EXACT_SEEK_FORMATS[] = {"flac", "wav", "aiff", "w64"};
+#ifdef MPL_MEM_DEBUG
+// # of packets decoded after a seek (or the start of the track) before decoding counts as warmed up, and should stop allocating
+static const size_t ALLOC_WARMUP_PACKETS = 32;
+#endif
 
-enum AudioTrack_ERR AudioTrack_init(AudioTrack *t, const char *url, AudioBackend *ab) {
+// Return whether *iformat is one of EXACT_SEEK_FORMATS
+static bool AudioTrack_exact_seek(const AVInputFormat *iformat) {
+	for (size_t i = 0; i < sizeof(EXACT_SEEK_FORMATS) / sizeof(EXACT_SEEK_FORMATS[0]); i++) {
+		if (strcmp(iformat->name, EXACT_SEEK_FORMATS[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+enum AudioTrack_ERR AudioTrack_init(AudioTrack *t, const char *url, AudioBackend *ab, const Settings *settings, AudioFileData *file_data) {
 	char av_err[AV_ERROR_MAX_STRING_SIZE]; // libav* library error message buffer
 
 	// Zero pointers to ensure AudioTrack_deinit is safe
 	memset(t, 0, sizeof(AudioTrack));
 
 	// Create av format demuxing context
-	int status = avformat_open_input(&t->avf_ctx, url, NULL, NULL);
+	int status = AudioIO_open_input(&t->avf_ctx, &t->io, url, settings, file_data);
 	if (status < 0) {
 		av_perror(status, av_err);
 		return AudioTrack_NOT_FOUND;
@@ -84,6 +113,12 @@ enum AudioTrack_ERR AudioTrack_init(AudioTrack *t, const char *url, AudioBackend
 #else
 	t->buf_pcm = t->src_pcm;
 #endif
+	// Pick how decoded frames are written into the buffer up front, so it isn't decided per frame
+	t->write_frames = AudioInterleave_select(&t->buf_pcm);
+	if (t->write_frames == NULL) {
+		LOG(Verbosity_NORMAL, "Unsupported sample format %s\n", av_get_sample_fmt_name(t->buf_pcm.sample_fmt));
+		return AudioTrack_CODEC_ERR;
+	}
 
 	// Compute timing info
 	const AVRational time_base = stream->time_base;
@@ -101,6 +136,14 @@ enum AudioTrack_ERR AudioTrack_init(AudioTrack *t, const char *url, AudioBackend
 	}
 	t->start_padding = codec_params->initial_padding;
 	t->end_padding = codec_params->trailing_padding;
+	t->seek_target = -1;
+
+	// Index seek points as we go, so seeks don't rely on (possibly approximate) demuxer seeking
+	t->byte_seek = !(t->avf_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK);
+	t->exact_seek = AudioTrack_exact_seek(t->avf_ctx->iformat);
+	if (SeekIndex_init(&t->seek_index, url, t->buf_pcm.sample_rate / SEEK_INDEX_RATE) != 0) {
+		return AudioTrack_BAD_ALLOC;
+	}
 
 
 	// Initialize decoding context
@@ -114,6 +157,18 @@ enum AudioTrack_ERR AudioTrack_init(AudioTrack *t, const char *url, AudioBackend
 		av_perror(status, av_err);
 		return AudioTrack_CODEC_ERR;
 	}
+	// Let the decoder use multiple threads if it can.
+	// Frame threading delays each frame's output by a packet per thread, which AudioTrack_buffer_packet() makes up for at EOF.
+	t->avc_ctx->thread_count = settings->at_decode_threads;
+	if (settings->at_decode_thread_type) {
+		t->avc_ctx->thread_type = 0;
+		if (strstr(settings->at_decode_thread_type, "frame")) {
+			t->avc_ctx->thread_type |= FF_THREAD_FRAME;
+		}
+		if (strstr(settings->at_decode_thread_type, "slice")) {
+			t->avc_ctx->thread_type |= FF_THREAD_SLICE;
+		}
+	}
 	status = avcodec_open2(t->avc_ctx, t->codec, NULL);
 	if (status < 0) {
 		av_perror(status, av_err);
@@ -153,17 +208,57 @@ void AudioTrack_deinit(AudioTrack *t) {
 		swr_free(&t->swr_ctx);
 	}
 #endif
-	avformat_close_input(&t->avf_ctx);
+	AudioIO_close_input(&t->avf_ctx, &t->io);
+	SeekIndex_deinit(&t->seek_index);
 }
 
-enum AudioTrack_ERR AudioTrack_init_buffers(AudioTrack *t, const Settings *settings) {
-	// Allocate playback buffer
+enum AudioTrack_ERR AudioTrack_init_buffers(AudioTrack *t, const Settings *settings, size_t max_bytes, AudioBufferPool *pool) {
+	// Read the file ahead on its own thread, so slow storage doesn't hold up decoding
+	if (AudioIO_prefetch(t->io, (size_t)settings->at_io_prefetch_kb * 1024) != 0) {
+		return AudioTrack_BAD_ALLOC;
+	}
+
+	// Segments start at seek points, which need exact demuxer seeks or a seek index to be found.
+	// Resampling carries state across segment boundaries, so it rules segments out.
+	bool segments = settings->at_decode_segments > 1 && (t->exact_seek || t->byte_seek);
+#ifdef MPL_RESAMPLE
+	segments = segments && !t->resample;
+#endif
+
+	// File I/O buffers come out of our budget first: our own, and those of the segment workers, which each open the file again
+	if (max_bytes) {
+		size_t io_bytes = AudioIO_buffer_size(t->io);
+		if (segments) {
+			io_bytes += (size_t)settings->at_decode_segments * settings->at_io_readahead_kb * 1024;
+		}
+		// If they take all of it, leave a token budget: halving it for the AudioBuffer mustn't give 0, i.e no limit
+		max_bytes = max_bytes > io_bytes + 2 ? max_bytes - io_bytes : 2;
+	}
+
+	// Allocate playback buffer, giving it up to half our budget
 	t->buffer = malloc(sizeof(AudioBuffer));
 	CHECK_ALLOC(t->buffer, AudioTrack_BAD_ALLOC);
-	if (AudioBuffer_init(t->buffer, &t->buf_pcm, settings) != 0) {
+	if (AudioBuffer_init(t->buffer, &t->buf_pcm, settings, t->duration_timecode, max_bytes / 2, pool) != 0) {
 		return AudioTrack_BUFFER_ERR;
 	}
 
+	// Set up packet read-ahead with whatever's left
+	PacketQueue_init(&t->packets);
+	if (max_bytes) {
+		t->packets.max_bytes = max_bytes > t->buffer->size ? max_bytes - t->buffer->size : 1;
+	}
+	t->packet_ahead = av_rescale_q(settings->at_packet_ahead, (AVRational){1, 1}, t->avf_ctx->streams[t->stream_no]->time_base);
+
+	// Pick up a seek index cached by a previous run
+	if (t->byte_seek && settings->at_seek_index_cache) {
+		SeekIndex_load(&t->seek_index);
+	}
+
+	if (segments) {
+		t->segments = SegmentDecoder_new(settings->at_decode_segments, settings);
+		CHECK_ALLOC(t->segments, AudioTrack_BAD_ALLOC);
+	}
+
 	// Allocate packet + frame memory
 	t->av_packet = av_packet_alloc();
 	t->av_frame = av_frame_alloc();
@@ -184,7 +279,14 @@ enum AudioTrack_ERR AudioTrack_init_buffers(AudioTrack *t, const Settings *setti
 }
 
 void AudioTrack_deinit_buffers(AudioTrack *t) {
+#ifdef MPL_MEM_DEBUG
+	if (t->n_warm_packets) {
+		LOG(Verbosity_DEBUG, "Made %" PRIu64 " heap allocations decoding %zu packets once warmed up (%.2f per packet)\n",
+				t->n_warm_allocs, t->n_warm_packets, (double)t->n_warm_allocs / t->n_warm_packets);
+	}
+#endif
 	// Free packet + frame memory
+	PacketQueue_deinit(&t->packets);
 	av_packet_free(&t->av_packet);
 	av_frame_free(&t->av_frame);
 #ifdef MPL_RESAMPLE
@@ -193,6 +295,11 @@ void AudioTrack_deinit_buffers(AudioTrack *t) {
 	}
 #endif
 
+	if (t->segments) {
+		SegmentDecoder_free(t->segments);
+		t->segments = NULL;
+	}
+
 	// Free playback buffer
 	if (t->buffer) {
 		AudioBuffer_deinit(t->buffer);
@@ -273,14 +380,19 @@ static int AudioTrack_advance_frame(AudioTrack *t) {
 			const int frame_insamples = t->av_frame_swr->nb_samples; // per ch
 			const int frame_outsamples_max = swr_get_out_samples(t->swr_ctx, frame_insamples); // per ch
 
-			// Perform resampling, using t->av_frame->extended as our dst for 1+ frames
-			if (frame_outsamples_max) {
+			// Perform resampling, using t->av_frame->extended as our dst for 1+ frames.
+			// Its buffer is kept from frame to frame, and only reallocated when a frame won't fit
+			if (frame_outsamples_max && (!t->av_frame->buf[0] || frame_outsamples_max > t->av_frame_capacity)) {
 				av_frame_unref(t->av_frame);
 				t->av_frame->sample_rate = t->buf_pcm.sample_rate;
 				t->av_frame->format = t->buf_pcm.sample_fmt;
 				t->av_frame->nb_samples = frame_outsamples_max;
 				av_channel_layout_default(&t->av_frame->ch_layout, t->buf_pcm.n_channels);
-				av_frame_get_buffer(t->av_frame, 0);
+				status = av_frame_get_buffer(t->av_frame, 0);
+				if (status < 0) {
+					return status;
+				}
+				t->av_frame_capacity = frame_outsamples_max;
 			}
 			t->av_frame->nb_samples = swr_convert(t->swr_ctx,
 					&t->av_frame->data[0], frame_outsamples_max,
@@ -295,90 +407,305 @@ static int AudioTrack_advance_frame(AudioTrack *t) {
 	return avcodec_receive_frame(t->avc_ctx, t->av_frame);
 }
 
-enum AudioTrack_ERR AudioTrack_buffer_packet(AudioTrack *t, size_t *n_bytes) {
+// Get the timestamp (in stream time_base units) of the start of t's audio stream
+static int64_t AudioTrack_start_ts(const AudioTrack *t) {
+	const AVStream *stream = t->avf_ctx->streams[t->stream_no];
+	return stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+}
+
+uint64_t AudioTrack_seek_preroll(const AudioTrack *t) {
+	// avc_ctx->frame_size is in source sample frames, and 0 if packets vary in size
+	const uint64_t packet = t->src_pcm.sample_rate > 0
+		? av_rescale(t->avc_ctx->frame_size, t->buf_pcm.sample_rate, t->src_pcm.sample_rate)
+		: 0;
+	const uint64_t min = (uint64_t)t->buf_pcm.sample_rate * SEEK_PREROLL_MIN_MS / 1000;
+	return packet > min ? packet : min;
+}
+
+// Seek the demuxer and decoder to sample frame # frame, leaving t's buffer as-is.
+// See AudioTrack_seek()
+static enum AudioTrack_ERR AudioTrack_seek_decoder(AudioTrack *t, uint64_t frame) {
 	char av_err[AV_ERROR_MAX_STRING_SIZE]; // libav* library error message buffer
 
-	if (n_bytes) {
-		*n_bytes = 0;
+	// Prefer seeking to an indexed packet, leaving the decoder some preroll
+	const SeekIndexEntry *entry = NULL;
+	if (t->byte_seek && SeekIndex_covers(&t->seek_index, frame)) {
+		const uint64_t preroll = AudioTrack_seek_preroll(t);
+		entry = SeekIndex_find(&t->seek_index, frame > preroll ? frame - preroll : 0);
+		if (!entry) {
+			entry = SeekIndex_find(&t->seek_index, frame);
+		}
 	}
-
-	// Read packet
 	int status;
-	do {
-		// WARNING: av_read_frame does NOT unref buffers
-		av_packet_unref(t->av_packet);
-		status = av_read_frame(t->avf_ctx, t->av_packet);
+	if (entry) {
+		status = av_seek_frame(t->avf_ctx, t->stream_no, entry->pos, AVSEEK_FLAG_BYTE);
 		if (status < 0) {
-			av_packet_unref(t->av_packet);
-			if (status == AVERROR_EOF) {
-				return AudioTrack_EOF;
-			}
 			av_perror(status, av_err);
-			return AudioTrack_PACKET_ERR;
+			entry = NULL;
 		}
-	} while (t->av_packet->stream_index != t->stream_no);
+	}
 
-	// Decode into frames
-	status = avcodec_send_packet(t->avc_ctx, t->av_packet);
-	if (status != 0) {
-		av_packet_unref(t->av_packet);
-		av_perror(status, av_err);
-		return AudioTrack_PACKET_ERR;
+	// Otherwise seek to the nearest seek point the demuxer knows of at or before our target
+	if (!entry) {
+		const AVStream *stream = t->avf_ctx->streams[t->stream_no];
+		const AVRational frame_tb = {1, t->buf_pcm.sample_rate};
+		const int64_t ts = AudioTrack_start_ts(t) + av_rescale_q(frame, frame_tb, stream->time_base);
+		status = av_seek_frame(t->avf_ctx, t->stream_no, ts, AVSEEK_FLAG_BACKWARD);
+		if (status < 0) {
+			av_perror(status, av_err);
+			return AudioTrack_SEEK_ERR;
+		}
+	}
+
+	// Drop any state left over from before the seek
+	avcodec_flush_buffers(t->avc_ctx);
+	t->drained = false;
+#ifdef MPL_MEM_DEBUG
+	t->n_packets_since_seek = 0;
+#endif
+#ifdef MPL_RESAMPLE
+	if (t->resample) {
+		swr_close(t->swr_ctx);
+		status = swr_init(t->swr_ctx);
+		if (status < 0) {
+			av_perror(status, av_err);
+			return AudioTrack_RESAMPLE_ERR;
+		}
+	}
+#endif
+	PacketQueue_clear(&t->packets);
+	av_packet_unref(t->av_packet);
+	av_frame_unref(t->av_frame);
+
+	if (entry) {
+		// We know exactly where we landed
+		t->seek_target = -1;
+		t->seek_discard = frame - entry->frame;
+		SeekIndex_jump(&t->seek_index, entry->frame);
+	} else {
+		// The first packet we read tells us how much we need to discard
+		t->seek_target = frame;
+		t->seek_discard = 0;
+		SeekIndex_jump(&t->seek_index, -1);
 	}
 
-	unsigned char *interleave_buf = NULL; // Intermediate buffer used to interleave planar samples before they're written to the playback buffer
-	unsigned int interleave_buf_size = 0;
+	return AudioTrack_OK;
+}
+
+enum AudioTrack_ERR AudioTrack_seek(AudioTrack *t, uint64_t frame) {
+	const enum AudioTrack_ERR err = AudioTrack_seek_decoder(t, frame);
+	if (err == AudioTrack_OK) {
+		AudioBuffer_reset(t->buffer, frame * t->buffer->frame_size);
+	}
+	return err;
+}
 
-	// Buffer each frame we decode
-	const bool is_planar = av_sample_fmt_is_planar(t->buf_pcm.sample_fmt);
-	const size_t buf_sample_size = av_get_bytes_per_sample(t->buf_pcm.sample_fmt);
-	status = AudioTrack_advance_frame(t);
+// Read the next packet of t's audio stream from the demuxer into *dst
+//
+// Return value is an averror
+static int AudioTrack_demux_packet(AudioTrack *t, AVPacket *dst) {
+	int status;
+	do {
+		// WARNING: av_read_frame does NOT unref buffers
+		av_packet_unref(dst);
+		status = av_read_frame(t->avf_ctx, dst);
+	} while (status >= 0 && dst->stream_index != t->stream_no);
+	if (status < 0) {
+		av_packet_unref(dst);
+	}
+	return status;
+}
+
+bool AudioTrack_read_ahead(AudioTrack *t) {
+	PacketQueue *q = &t->packets;
+	if (q->eof || q->len >= PACKET_AHEAD_MAX || PacketQueue_full(q) || PacketQueue_ahead(q) >= t->packet_ahead) {
+		return false;
+	}
+
+	AVPacket *pkt = PacketQueue_reserve(q);
+	if (!pkt) {
+		return false;
+	}
+	const int status = AudioTrack_demux_packet(t, pkt);
+	if (status < 0) {
+		// Hold on to the demuxer's error until decoding catches up with it
+		q->eof = true;
+		q->eof_status = status;
+		return false;
+	}
+	PacketQueue_commit(q);
+	return true;
+}
+
+// Buffer every frame the decoder has ready, adding the number of bytes buffered to *n_bytes (if not NULL).
+//
+// Return value is the averror that ended decoding: AVERROR(EAGAIN) when the decoder needs another packet,
+// or AVERROR_EOF once it's been drained
+static int AudioTrack_buffer_frames(AudioTrack *t, size_t *n_bytes) {
+	// Buffer each frame we decode, writing straight into the playback buffer
+	const size_t buf_frame_size = t->buffer->frame_size;
+	int status = AudioTrack_advance_frame(t);
 	for (; status >= 0; status = AudioTrack_advance_frame(t)) {
 		const AVFrame *frame = t->av_frame;
-		size_t frame_size = frame->nb_samples * t->buf_pcm.n_channels * buf_sample_size;
-
-		unsigned char *frame_data = NULL;
-		if (is_planar) {
-			// Interleave samples
-			av_fast_malloc(&interleave_buf, &interleave_buf_size, frame_size);
-			CHECK_ALLOC(interleave_buf, AudioTrack_BAD_ALLOC);
-
-			size_t interleave_idx = 0;
-			for (size_t samp = 0; samp < frame->nb_samples; samp++) {
-				for (size_t ch = 0; ch < t->buf_pcm.n_channels; ch++) {
-					static const size_t n_data = sizeof(frame->data) / sizeof(frame->data[0]);
-					unsigned char *line = ch < n_data ? frame->data[ch] : frame->extended_data[ch];
-					unsigned char *sample = &line[samp * buf_sample_size];
-					memcpy(&interleave_buf[interleave_idx], sample, buf_sample_size);
-					interleave_idx += buf_sample_size;
-				}
+		const size_t nb_samples = frame->nb_samples;
+
+		// Skip samples decoded ahead of a seek target
+		const size_t n_discard = t->seek_discard < nb_samples ? t->seek_discard : nb_samples;
+		t->seek_discard -= n_discard;
+
+		size_t samp = n_discard; // # of samples (per-ch) buffered or discarded
+		while (samp < nb_samples) {
+			unsigned char *dst;
+			size_t dst_size;
+			AudioBuffer_write_reserve(t->buffer, (nb_samples - samp) * buf_frame_size, &dst, &dst_size);
+			if (dst_size == 0) {
+				// Wait for the buffer to be read from
+				AudioBuffer_wait_drain(t->buffer, t->buffer->size - buf_frame_size);
+				continue;
 			}
+			const size_t dst_samples = dst_size / buf_frame_size;
 
-			// Buffer interleaved result
-			frame_data = interleave_buf;
-		} else {
-			// Our result is already interleaved
-			frame_data = frame->data[0];
-		}
+			t->write_frames(dst, (const uint8_t *const *)frame->extended_data, samp, dst_samples, t->buf_pcm.n_channels);
 
-		size_t n = 0;
-		while (n < frame_size) {
-			n += AudioBuffer_write(t->buffer, &frame_data[n], frame_size - n);
-			if (n < frame_size) {
-				sem_wait(&t->buffer->rd_sem);
-			}
+			AudioBuffer_write_commit(t->buffer, dst_size);
+			samp += dst_samples;
 		}
 		if (n_bytes) {
-			*n_bytes += n;
+			*n_bytes += (nb_samples - n_discard) * buf_frame_size;
 		}
 	}
-	av_freep(&interleave_buf);
+	// Hand the decoder's frame back to it. When resampling, t->av_frame is our own and kept for the next packet
+#ifdef MPL_RESAMPLE
+	if (t->resample) {
+		av_frame_unref(t->av_frame_swr);
+	} else {
+		av_frame_unref(t->av_frame);
+	}
+#else
 	av_frame_unref(t->av_frame);
+#endif
+
+	return status;
+}
+
+enum AudioTrack_ERR AudioTrack_buffer_packet(AudioTrack *t, size_t *n_bytes) {
+	char av_err[AV_ERROR_MAX_STRING_SIZE]; // libav* library error message buffer
+
+	if (n_bytes) {
+		*n_bytes = 0;
+	}
+
+	// Read packet, preferring one we've already read ahead
+	int status = 0;
+	av_packet_unref(t->av_packet);
+	if (!PacketQueue_pop(&t->packets, t->av_packet)) {
+		status = t->packets.eof ? t->packets.eof_status : AudioTrack_demux_packet(t, t->av_packet);
+	}
+	if (status < 0) {
+		if (status == AVERROR_EOF) {
+			if (t->byte_seek) {
+				SeekIndex_finish(&t->seek_index);
+			}
+			// Flush out the frames the decoder is still holding on to.
+			// With frame threading, that's up to one frame per thread.
+			if (!t->drained) {
+				avcodec_send_packet(t->avc_ctx, NULL);
+				AudioTrack_buffer_frames(t, n_bytes);
+				t->drained = true;
+			}
+			return AudioTrack_EOF;
+		}
+		av_perror(status, av_err);
+		return AudioTrack_PACKET_ERR;
+	}
+
+#ifdef MPL_MEM_DEBUG
+	// Once the decoder's warmed up, decoding packets into the buffer shouldn't allocate (libav* aside)
+	const uint64_t n_allocs = AllocCount_thread();
+#endif
+
+	// Get the sample frame this packet starts at
+	int64_t pkt_frame = -1;
+	if (t->av_packet->pts != AV_NOPTS_VALUE) {
+		const AVRational frame_tb = {1, t->buf_pcm.sample_rate};
+		pkt_frame = av_rescale_q(t->av_packet->pts - AudioTrack_start_ts(t),
+				t->avf_ctx->streams[t->stream_no]->time_base, frame_tb);
+		if (t->byte_seek) {
+			SeekIndex_note(&t->seek_index, t->av_packet->pos, pkt_frame);
+		}
+	}
+	// Work out how far ahead of the last seek target the demuxer landed us
+	if (t->seek_target >= 0) {
+		if (pkt_frame >= 0) {
+			t->seek_discard = t->seek_target > pkt_frame ? t->seek_target - pkt_frame : 0;
+		}
+		t->seek_target = -1;
+	}
+
+	// Decode into frames
+	status = avcodec_send_packet(t->avc_ctx, t->av_packet);
+	if (status != 0) {
+		av_packet_unref(t->av_packet);
+		av_perror(status, av_err);
+		return AudioTrack_PACKET_ERR;
+	}
+
+	AudioTrack_buffer_frames(t, n_bytes);
 	av_packet_unref(t->av_packet);
 
+#ifdef MPL_MEM_DEBUG
+	if (++t->n_packets_since_seek > ALLOC_WARMUP_PACKETS) {
+		t->n_warm_packets++;
+		t->n_warm_allocs += AllocCount_thread() - n_allocs;
+	}
+#endif
+
 	return AudioTrack_OK;
 }
 
+enum AudioTrack_ERR AudioTrack_buffer_segments(AudioTrack *t, size_t *n_bytes) {
+	if (n_bytes) {
+		*n_bytes = 0;
+	}
+	if (!t->segments) {
+		return AudioTrack_OK;
+	}
+
+	// Only take over when there's (nearly) nothing left to play. Refills are left to sequential decoding,
+	// so they don't throw away the packets it has read ahead.
+	AudioBuffer *buf = t->buffer;
+	const uint64_t min_frames = (uint64_t)t->buf_pcm.sample_rate * SEGMENT_MIN_SECONDS;
+	if (AudioBuffer_max_read(buf, false) >= min_frames * buf->frame_size) {
+		return AudioTrack_OK;
+	}
+
+	// Decode from the write position up to the high watermark, or the end of the track
+	const uint64_t first = AudioBuffer_n_written(buf) / buf->frame_size;
+	uint64_t last = (AudioBuffer_n_read(buf) + buf->high_watermark) / buf->frame_size;
+	if (t->duration_timecode > 0 && last > (uint64_t)t->duration_timecode) {
+		last = t->duration_timecode;
+	}
+	if (last <= first || last - first < 2 * min_frames) {
+		return AudioTrack_OK;
+	}
+	// Without exact demuxer seeks, every segment has to start at an indexed seek point
+	if (!t->exact_seek && !(t->byte_seek && SeekIndex_covers(&t->seek_index, last))) {
+		return AudioTrack_OK;
+	}
+
+	const uint64_t n_frames = SegmentDecoder_decode(t->segments, t, first, last, min_frames);
+	if (n_frames == 0) {
+		return AudioTrack_OK;
+	}
+	AudioBuffer_write_commit(buf, n_frames * buf->frame_size);
+	if (n_bytes) {
+		*n_bytes = n_frames * buf->frame_size;
+	}
+
+	// Pick up sequential decoding where the segments left off
+	return AudioTrack_seek_decoder(t, first + n_frames);
+}
+
 enum AudioTrack_ERR AudioTrack_buffer_ms(AudioTrack *t, enum AudioSeek dir, const uint32_t ms) {
 	// Compute the number of bytes we want to buffer
 	const size_t n_bytes = AudioPCM_buffer_size(&t->buf_pcm, ms);
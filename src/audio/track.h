@@ -1,6 +1,11 @@
 #pragma once
 #include "audio/seek.h"
 #include "buffer.h"
+#include "interleave.h"
+#include "io.h"
+#include "packet_queue.h"
+#include "seek_index.h"
+#include "segment.h"
 #include "config/settings.h"
 #include "track_meta.h"
 #include "ui/event.h"
@@ -25,8 +30,13 @@ typedef struct AudioBackend AudioBackend; // break circular dependency between A
 typedef struct AudioTrack {
 	// Demuxing
 	AVFormatContext *avf_ctx;
+	AudioIO *io; // Reads avf_ctx's file, or NULL if libavformat does
 	int stream_no; // Stream # to use for audio playback
 
+	// Compressed packets read ahead of decoding
+	PacketQueue packets;
+	int64_t packet_ahead; // How far ahead (in stream time_base units) to read packets
+
 	// Decoding
 	AVCodecContext *avc_ctx;
 	const AVCodec *codec;
@@ -39,36 +49,76 @@ typedef struct AudioTrack {
 	SwrContext *swr_ctx;
 	AVAudioFifo *swr_fifo;
 	AVFrame *av_frame_swr; // Pre-resampling input frame
+	int av_frame_capacity; // # of samples (per-ch) av_frame's buffer has room for, which is kept between frames to resample into
 #endif
 	
 	// PCM playback
 	AudioPCM src_pcm; // (pre-resample if needed) PCM format we decode
 	AudioPCM buf_pcm; // (post-resample if needed) PCM format we buffer for playback
+	AudioConvertFn write_frames; // Writes decoded frames into the buffer, interleaving them if buf_pcm is planar
 	AudioBuffer *buffer;
 
+	// Seeking
+	int64_t seek_target; // Sample frame a demuxer seek was made to, or -1 once decoding has caught up with it
+	size_t seek_discard; // # of decoded sample frames still to be discarded to land exactly on the last seek target
+	bool byte_seek; // Whether the demuxer can seek to byte positions, which is needed to make use of seek_index
+	bool exact_seek; // Whether demuxer seeks land exactly on a packet with an exact timestamp, i.e without needing seek_index
+	SeekIndex seek_index; // Packet positions of seek points, built up while buffering
+	bool drained; // Whether the decoder has been flushed of its last frames at EOF (reset by seeking)
+	SegmentDecoder *segments; // Decodes the buffer's look-ahead in parallel after seeks and track changes, or NULL if disabled
+
 	// Metadata
 	// NOTE: all units of sample frames are post-resample frames
 	EventBody_Timecode duration_timecode; // Duration in sample frames
 	size_t start_padding, end_padding; // The number of sample frames at the start and end of the track used for padding. These must be discarded for gapless playback.
+
+#ifdef MPL_MEM_DEBUG
+	// Heap allocations made decoding packets into the buffer once warmed up, which should be none (see AudioTrack_buffer_packet())
+	size_t n_packets_since_seek;
+	size_t n_warm_packets;
+	uint64_t n_warm_allocs;
+#endif
 } AudioTrack;
 
 
-// Initialize an AudioTrack for playback with an AudioBackend
-enum AudioTrack_ERR AudioTrack_init(AudioTrack *at, const char *url, AudioBackend *ab);
+// Initialize an AudioTrack for playback with an AudioBackend, decoding with the threading configured in *settings.
+// The track's file is read from file_data if it isn't NULL (see AudioIO_open_input(), which takes over the reference).
+enum AudioTrack_ERR AudioTrack_init(AudioTrack *at, const char *url, AudioBackend *ab, const Settings *settings, AudioFileData *file_data);
 void AudioTrack_deinit(AudioTrack *at);
 
-// Initialize an AudioTrack's buffers, making it ready for buffering
+// Initialize an AudioTrack's buffers, making it ready for buffering.
+// The AudioBuffer, read-ahead packets and file I/O buffers (see AudioIO_prefetch()) are kept within max_bytes between them (0 for no limit).
+// The AudioBuffer's memory is recycled through *pool if it isn't NULL (see AudioBuffer_init()).
 // WARN: calling any AudioTrack_buffer_* methods before calling AudioTrack_init_buffers is UB
-enum AudioTrack_ERR AudioTrack_init_buffers(AudioTrack *at, const Settings *settings);
+enum AudioTrack_ERR AudioTrack_init_buffers(AudioTrack *at, const Settings *settings, size_t max_bytes, AudioBufferPool *pool);
 // Deinitialize and free an AudioTrack's buffers
 void AudioTrack_deinit_buffers(AudioTrack *at);
 
 // Retrieve metadata from an AudioTrack's decoding context, storing the result in *meta
 enum AudioTrack_ERR AudioTrack_get_metadata(AudioTrack *at, TrackMeta *meta);
 
+// Read one compressed packet ahead of decoding, if we're not yet settings->at_packet_ahead seconds ahead.
+// Returns whether a packet was read.
+// WARN: calling any AudioTrack_buffer_* methods before calling AudioTrack_init_buffers is UB
+bool AudioTrack_read_ahead(AudioTrack *at);
 // Buffer one packet worth of frames and set n_bytes (if not NULL) to the number of bytes buffered in doing so.
 // WARN: calling any AudioTrack_buffer_* methods before calling AudioTrack_init_buffers is UB
 enum AudioTrack_ERR AudioTrack_buffer_packet(AudioTrack *at, size_t *n_bytes);
+// If the AudioTrack's buffer is (nearly) empty, i.e after a seek or track change, decode everything up to its high watermark
+// in parallel segments, then pick up sequential decoding where they left off.
+// Only does anything if settings->at_decode_segments enabled segment decoding for the track,
+// and the track's seek points can be found exactly (see AudioTrack.exact_seek).
+// Sets n_bytes (if not NULL) to the number of bytes buffered, which is 0 if the AudioTrack should buffer sequentially instead.
+// WARN: calling any AudioTrack_buffer_* methods before calling AudioTrack_init_buffers is UB
+enum AudioTrack_ERR AudioTrack_buffer_segments(AudioTrack *at, size_t *n_bytes);
+// Get the # of sample frames (at the buffer's sample rate) of preroll to leave the decoder ahead of a seek target:
+// one of its packets, but no less than a fixed minimum, since packets may vary in size
+uint64_t AudioTrack_seek_preroll(const AudioTrack *at);
+// Seek the demuxer and decoder to sample frame # frame, dropping everything held in the AudioTrack's buffer.
+// Decoding resumes at the nearest seek point before frame, and anything decoded ahead of frame is discarded.
+// Seek points come from the AudioTrack's seek index when it covers frame, and from the demuxer otherwise.
+// NOTE: the AudioTrack's buffer must be locked as for AudioBuffer_seek(), and nothing else may be decoding from it.
+enum AudioTrack_ERR AudioTrack_seek(AudioTrack *at, uint64_t frame);
 // Buffer track data. AudioSeek_Relative will buffer onto the end of the Track's current AudioBuffer.
 // WARN: calling any AudioTrack_buffer_* methods before calling AudioTrack_init_buffers is UB
 enum AudioTrack_ERR AudioTrack_buffer_ms(AudioTrack *at, enum AudioSeek dir, const uint32_t ms);
@@ -12,6 +12,39 @@ void register_ConfigSetting_settings(ConfigSettingDict *dict) {
 
 	ConfigSettingDict_define(dict, "at_buffer_ahead",
 			def, &def->at_buffer_ahead);
+	ConfigSettingDict_define(dict, "at_packet_ahead",
+			def, &def->at_packet_ahead);
+	ConfigSettingDict_define(dict, "at_buffer_refill",
+			def, &def->at_buffer_refill);
+	ConfigSettingDict_define(dict, "at_buffer_whole_mb",
+			def, &def->at_buffer_whole_mb);
+	ConfigSettingDict_define(dict, "at_buffer_budget_mb",
+			def, &def->at_buffer_budget_mb);
+	ConfigSettingDict_define(dict, "at_seek_index_cache",
+			def, &def->at_seek_index_cache);
+	ConfigSettingDict_define(dict, "at_meta_cache",
+			def, &def->at_meta_cache);
+	ConfigSettingDict_define(dict, "at_buffer_lock",
+			def, &def->at_buffer_lock);
+	ConfigSettingDict_define(dict, "at_decode_threads",
+			def, &def->at_decode_threads);
+	ConfigSettingDict_define(dict, "at_decode_thread_type",
+			def, &def->at_decode_thread_type);
+	ConfigSettingDict_define(dict, "at_decode_segments",
+			def, &def->at_decode_segments);
+	ConfigSettingDict_define(dict, "at_io_mmap",
+			def, &def->at_io_mmap);
+	ConfigSettingDict_define(dict, "at_io_readahead_kb",
+			def, &def->at_io_readahead_kb);
+	ConfigSettingDict_define(dict, "at_io_prefetch_kb",
+			def, &def->at_io_prefetch_kb);
+	ConfigSettingDict_define(dict, "at_io_uring_depth",
+			def, &def->at_io_uring_depth);
+
+	ConfigSettingDict_define(dict, "queue_prefetch_tracks",
+			def, &def->queue_prefetch_tracks);
+	ConfigSettingDict_define(dict, "queue_prefetch_mb",
+			def, &def->queue_prefetch_mb);
 
 	ConfigSettingDict_define(dict, "audio_backend",
 			def, &def->audio_backend);
@@ -8,6 +8,7 @@ void Settings_init(Settings *opts) {
 }
 
 void Settings_deinit(Settings *opts) {
+	free(opts->at_decode_thread_type);
 	free(opts->audio_backend);
 	free(opts->user_interface);
 }
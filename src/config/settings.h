@@ -6,7 +6,24 @@
 
 // Settings configurable in mpl.conf
 typedef struct Settings {
-	uint32_t at_buffer_ahead; // number of seconds to buffer ahead for each track
+	uint32_t at_buffer_ahead; // number of seconds of decoded audio to buffer ahead for each track (kept small, since at_packet_ahead covers I/O stalls)
+	uint32_t at_packet_ahead; // number of seconds of compressed packets to read ahead of the buffer, for each track
+	uint32_t at_buffer_refill; // number of seconds left buffered ahead at which buffering resumes
+	uint32_t at_buffer_whole_mb; // max size (in MiB) of a track's decoded audio for it to be buffered whole, 0 to disable
+	uint32_t at_buffer_budget_mb; // max memory (in MiB) used by all track buffers (decoded audio + read-ahead packets + file I/O buffers, but not files read into memory ahead of time), 0 for no limit
+	bool at_seek_index_cache; // Cache track seek indexes on disk (in $XDG_CACHE_HOME/mpl/seek)
+	bool at_meta_cache; // Cache track metadata and stream info on disk (in $XDG_CACHE_HOME/mpl/meta.cache), so queued tracks needn't be probed again
+	bool at_buffer_lock; // Lock track buffers into RAM (pre-faulted, mlock()ed and backed by huge pages where possible) so playback never page faults
+	uint32_t at_decode_threads; // # of threads each track's decoder may use, 0 for one per CPU core
+	char *at_decode_thread_type; // Kinds of decoder threading to allow ("frame", "slice" or "frame,slice"), NULL for both
+	uint32_t at_decode_segments; // # of threads to decode a track's look-ahead with in parallel segments after seeks and track changes, 0 or 1 to disable
+	bool at_io_mmap; // Read local track files by mapping them into memory, instead of in at_io_readahead_kb chunks. WARN: mpl is killed (SIGBUS) if a mapped file is truncated while it plays
+	uint32_t at_io_readahead_kb; // KiB of local track files to read (and have the kernel read ahead) at a time, 0 to leave file I/O to libavformat
+	uint32_t at_io_prefetch_kb; // KiB of each buffering track's file to read ahead of the demuxer on a separate thread, 0 to disable
+	uint32_t at_io_uring_depth; // # of at_io_prefetch_kb reads to keep in flight at once through io_uring (Linux only), 0 to make them one at a time
+
+	uint32_t queue_prefetch_tracks; // # of tracks after the current one whose whole files are read into memory ahead of time, 0 to disable
+	uint32_t queue_prefetch_mb; // max memory (in MiB) used by files read into memory ahead of time
 
 	char *audio_backend; // Name of audio backend to use (e.g "pulseaudio", "pipewire", "wasapi", "fast")
 	uint32_t ab_buffer_ms; // number of ms to buffer with the audio backend (i.e pulseaudio)
@@ -17,7 +34,24 @@ typedef struct Settings {
 
 // Default values for all settings
 static const Settings default_settings = {
-	.at_buffer_ahead = 30,
+	.at_buffer_ahead = 10,
+	.at_packet_ahead = 120,
+	.at_buffer_refill = 5,
+	.at_buffer_whole_mb = 0,
+	.at_buffer_budget_mb = 0,
+	.at_seek_index_cache = true,
+	.at_meta_cache = true,
+	.at_buffer_lock = false,
+	.at_decode_threads = 1,
+	.at_decode_thread_type = NULL, // let libavcodec use frame and slice threading
+	.at_decode_segments = 0,
+	.at_io_mmap = false,
+	.at_io_readahead_kb = 256,
+	.at_io_prefetch_kb = 4096,
+	.at_io_uring_depth = 4,
+
+	.queue_prefetch_tracks = 0,
+	.queue_prefetch_mb = 512,
 
 	.audio_backend = NULL, // use default AudioBackened
 	.ab_buffer_ms = 100,
@@ -75,6 +75,7 @@ static inline const char *AudioBackend_ERR_name(enum AudioBackend_ERR err) {
 	VARIANT(AudioTrack_PACKET_ERR) \
 	VARIANT(AudioTrack_FRAME_ERR) \
 	VARIANT(AudioTrack_RESAMPLE_ERR) \
+	VARIANT(AudioTrack_SEEK_ERR) \
 	VARIANT(AudioTrack_PREBUF_EOF)
 
 // Errors returned by an AudioTrack_* method
@@ -1,16 +1,23 @@
 #include "config/config.h"
 #include "config/function/state.h"
 #include "error.h"
+#include "meta_cache.h"
+#include "track_queue/probe.h"
 #include "track_queue/queue.h"
-#include "track.h"
 #include "ui/cli_args.h"
 #include "util/log.h"
 #include "ui/interface/interface.h"
 #include "ui/interface/interfaces.h"
+#ifdef MPL_MEM_DEBUG
+#include "util/alloc_count.h"
+#endif
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 
 int main(int argc, const char **argv) {
@@ -18,11 +25,14 @@ int main(int argc, const char **argv) {
 
 	// Parse CLI args
 	if (argc < 2) {
-		fprintf(stderr, "usage: mpl [-v] [-vv] {file}\n");
+		fprintf(stderr, "usage: mpl [-v] [-vv] {file...}\n");
 		return 1;
 	}
 	args_parse(argc, argv);
 	configure_av_log(); // Configure libav logging
+#ifdef MPL_MEM_DEBUG
+	AllocCount_init();
+#endif
 	LOG(Verbosity_VERBOSE, "Logging enabled: %s\n", Verbosity_name(cli_args.verbosity));
 
 	// Parse mpl.conf
@@ -42,14 +52,31 @@ int main(int argc, const char **argv) {
 		goto deinit_config;
 	}
 
-	// Form URL from file argv
-	const char *file = argv[argc-1];
+	// Form URLs from file argv: every arg that isn't a flag (see args_parse()), and everything after `--`
 	static const char LIBAV_PROTO_FILE[] = "file:";
 	static const size_t LIBAV_PROTO_FILE_LEN = sizeof(LIBAV_PROTO_FILE);
-	const size_t url_len = LIBAV_PROTO_FILE_LEN + strlen(file);
-	char *url = malloc((url_len + 1) * sizeof(char));
-	if (!url) goto deinit_config;
-	snprintf(url, url_len, "%s%s", LIBAV_PROTO_FILE, file);
+	char **urls = calloc(argc, sizeof(char *));
+	size_t n_urls = 0;
+	if (!urls) {
+		ret = 1;
+		goto deinit_ui;
+	}
+	bool parse_flags = true;
+	for (int i = 1; i < argc; i++) {
+		const char *file = argv[i];
+		if (parse_flags && file[0] == '-' && strlen(file) >= 2) {
+			parse_flags = strcmp(file, "--") != 0;
+			continue;
+		}
+		const size_t url_len = LIBAV_PROTO_FILE_LEN + strlen(file);
+		urls[n_urls] = malloc((url_len + 1) * sizeof(char));
+		if (!urls[n_urls]) {
+			ret = 1;
+			goto free_urls;
+		}
+		snprintf(urls[n_urls], url_len, "%s%s", LIBAV_PROTO_FILE, file);
+		n_urls++;
+	}
 
 	// Initialize track queue
 	TrackQueue queue;
@@ -57,7 +84,7 @@ int main(int argc, const char **argv) {
 	if (queue_err != 0) {
 		LOG(Verbosity_NORMAL, "Failed to initialize track queue, exiting\n");
 		ret = 1;
-		goto deinit_ui;
+		goto free_urls;
 	}
 	// Connect audio
 	enum AudioBackend_ERR ab_err = TrackQueue_connect_audio(&queue, &config.settings, ui->evt_queue);
@@ -66,11 +93,18 @@ int main(int argc, const char **argv) {
 		ret = 1;
 		goto deinit_queue;
 	}
-	// Append track to queue
-	queue_err = TrackQueue_prepend(&queue, Track_new(url, url_len, queue.backend));
-	if (queue_err != 0) {
+	// Probe tracks in the background. The UI queues them as they're probed, and starts playback with the first
+	MetaCache *meta_cache = config.settings.at_meta_cache ? MetaCache_open() : NULL;
+	ProbePool *probe_pool = ProbePool_new(queue.backend, &config.settings, meta_cache);
+	if (!probe_pool) {
+		LOG(Verbosity_NORMAL, "Failed to start probing tracks, exiting\n");
 		ret = 1;
-		goto deinit_queue;
+		goto close_cache;
+	}
+	if (ProbePool_probe(probe_pool, ui->evt_queue, (const char *const *)urls, n_urls) != 0) {
+		LOG(Verbosity_NORMAL, "Failed to start probing tracks, exiting\n");
+		ret = 1;
+		goto deinit_probe;
 	}
 
 	// Make config functions control MPL
@@ -84,10 +118,21 @@ int main(int argc, const char **argv) {
 
 	// Cleanup
 	// (The UI must outlive everything that can send it events, including the Queue and AudioBackend)
+deinit_probe:
+	LOG(Verbosity_DEBUG, "Deinitializing ProbePool\n");
+	ProbePool_free(probe_pool);
+close_cache:
+	if (meta_cache) {
+		MetaCache_close(meta_cache);
+	}
 deinit_queue:
 	LOG(Verbosity_DEBUG, "Deinitializing Queue\n");
 	TrackQueue_deinit(&queue);
-	free(url);
+free_urls:
+	for (size_t i = 0; i < n_urls; i++) {
+		free(urls[i]);
+	}
+	free(urls);
 deinit_ui:
 	LOG(Verbosity_DEBUG, "Deinitializing UI\n");
 	UserInterface_deinit(ui);
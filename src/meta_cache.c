@@ -0,0 +1,484 @@
+#include "meta_cache.h"
+#include "error.h"
+#include "track_meta.h"
+#include "util/compat/string_win32.h"
+#include "util/log.h"
+#include "util/path.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout of the cache file: a header, then an index of every entry sorted by the hash of its track's path, then the entries
+// themselves. Fields are in native byte order, and every entry starts 8-byte aligned.
+// Bump METACACHE_VERSION whenever the layout changes: files of any other version are ignored, and replaced on the next save.
+struct MetaCacheFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_entries;
+	uint64_t size; // Size of the whole file, so truncated files are caught up front
+};
+static const char METACACHE_MAGIC[8] = {'M', 'P', 'L', 'M', 'E', 'T', 'A', '\0'};
+static const uint32_t METACACHE_VERSION = 2;
+// Age (in seconds) at which entries expire, so those for tracks that have been deleted are eventually dropped.
+// Lookups miss on expired entries, so tracks that are still played get probed and cached again
+static const int64_t METACACHE_MAX_AGE = 90 * 24 * 60 * 60;
+
+struct MetaCacheIndexEntry {
+	uint64_t hash;
+	uint64_t offset; // Offset of the entry from the start of the file
+};
+
+// A cached entry, followed by its track's path and tags (without NUL terminators)
+struct MetaCacheRecord {
+	// Version of the track file the entry was cached for
+	int64_t mtime;
+	int64_t size;
+	int64_t cached_at; // When the entry was cached (seconds since the Epoch)
+
+	int64_t duration;
+	uint64_t start_padding, end_padding;
+	int32_t codec_id;
+	int32_t sample_fmt;
+	uint32_t sample_rate;
+	uint32_t n_channels;
+
+	uint32_t path_len;
+	uint32_t name_len, artist_len, album_len; // METACACHE_NO_TAG for tags the track doesn't have
+};
+static const uint32_t METACACHE_NO_TAG = UINT32_MAX;
+
+// An entry to be saved, packed as it's laid out in the file
+typedef struct MetaCachePacked {
+	uint64_t hash;
+	unsigned char *data;
+	size_t size;
+} MetaCachePacked;
+
+struct MetaCache {
+	char *path;
+
+	// Cache file as it was when the cache was opened (NULL if there was none)
+	void *map;
+	size_t map_size;
+	const struct MetaCacheIndexEntry *index;
+	size_t n_entries;
+
+	pthread_mutex_t lock; // Guards new entries
+	MetaCachePacked *new_entries;
+	size_t n_new, cap_new;
+};
+
+// FNV-1a hash of the first len bytes of *s
+static uint64_t MetaCache_hash(const char *s, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)s[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static size_t MetaCache_tag_len(uint32_t len) {
+	return len == METACACHE_NO_TAG ? 0 : len;
+}
+
+// Get the entry at offset in a cache file of size bytes, checking it lies within the file.
+// Copies the entry's record into *rec, and returns its path (followed by its tags), or NULL if it's out of bounds.
+static const char *MetaCache_record(const void *file, size_t size, uint64_t offset, struct MetaCacheRecord *rec) {
+	if (offset % 8 != 0 || offset > size || size - offset < sizeof(struct MetaCacheRecord)) {
+		return NULL;
+	}
+	memcpy(rec, (const unsigned char *)file + offset, sizeof(struct MetaCacheRecord));
+	const uint64_t strings_len = (uint64_t)rec->path_len + MetaCache_tag_len(rec->name_len)
+		+ MetaCache_tag_len(rec->artist_len) + MetaCache_tag_len(rec->album_len);
+	if (strings_len > size - offset - sizeof(struct MetaCacheRecord)) {
+		return NULL;
+	}
+	return (const char *)file + offset + sizeof(struct MetaCacheRecord);
+}
+
+// Get the size in bytes of a (valid) record's entry, including the padding that keeps the next entry aligned
+static size_t MetaCache_record_size(const struct MetaCacheRecord *rec) {
+	const size_t size = sizeof(struct MetaCacheRecord) + rec->path_len + MetaCache_tag_len(rec->name_len)
+		+ MetaCache_tag_len(rec->artist_len) + MetaCache_tag_len(rec->album_len);
+	return (size + 7) & ~(size_t)7;
+}
+
+// Return whether a record has expired (see METACACHE_MAX_AGE) by time now
+static bool MetaCache_expired(const struct MetaCacheRecord *rec, int64_t now) {
+	return now - rec->cached_at > METACACHE_MAX_AGE;
+}
+
+#ifndef __WIN32
+// Map the cache file at *path, setting *index and *n_entries to its index.
+// Returns the mapping, or NULL if there's no (usable) cache file. Unmap it with munmap(map, *size).
+static void *MetaCache_map(const char *path, size_t *size, const struct MetaCacheIndexEntry **index, size_t *n_entries) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct MetaCacheFileHeader)) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	// The file is replaced rather than written to, so our mapping never changes under us
+	void *map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	struct MetaCacheFileHeader hdr;
+	memcpy(&hdr, map, sizeof(hdr));
+	if (memcmp(hdr.magic, METACACHE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != METACACHE_VERSION
+			|| hdr.size != *size
+			|| hdr.n_entries > (*size - sizeof(hdr)) / sizeof(struct MetaCacheIndexEntry)) {
+		LOG(Verbosity_DEBUG, "Ignoring outdated or corrupt metadata cache %s\n", path);
+		munmap(map, *size);
+		return NULL;
+	}
+	*index = (const struct MetaCacheIndexEntry *)((const unsigned char *)map + sizeof(hdr));
+	*n_entries = hdr.n_entries;
+	return map;
+}
+#endif
+
+MetaCache *MetaCache_open(void) {
+#ifdef __WIN32
+	return NULL;
+#else
+	MetaCache *mc = malloc(sizeof(MetaCache));
+	CHECK_ALLOC(mc, NULL);
+	memset(mc, 0, sizeof(MetaCache));
+
+	size_t path_len;
+	const char *parts[] = {"meta.cache"};
+	if (path_cache(&mc->path, &path_len, parts, sizeof(parts) / sizeof(parts[0])) != 0) {
+		free(mc);
+		return NULL;
+	}
+	pthread_mutex_init(&mc->lock, NULL);
+
+	mc->map = MetaCache_map(mc->path, &mc->map_size, &mc->index, &mc->n_entries);
+	if (mc->map) {
+		LOG(Verbosity_DEBUG, "Loaded metadata cache %s (%zu entries)\n", mc->path, mc->n_entries);
+	}
+	return mc;
+#endif
+}
+
+bool MetaCache_get(MetaCache *mc, const char *url, MetaCacheEntry *entry) {
+#ifdef __WIN32
+	return false;
+#else
+	const char *path = path_from_url(url);
+	if (!mc->map || !path) {
+		return false;
+	}
+	const size_t path_len = strlen(path);
+	const uint64_t hash = MetaCache_hash(path, path_len);
+
+	// Binary search for the first entry with our hash
+	size_t lo = 0, hi = mc->n_entries;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (mc->index[mid].hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	struct MetaCacheRecord rec;
+	const char *strings = NULL;
+	for (; lo < mc->n_entries && mc->index[lo].hash == hash; lo++) {
+		strings = MetaCache_record(mc->map, mc->map_size, mc->index[lo].offset, &rec);
+		if (strings && rec.path_len == path_len && memcmp(strings, path, path_len) == 0) {
+			break;
+		}
+		strings = NULL;
+	}
+	if (!strings) {
+		return false;
+	}
+
+	if (MetaCache_expired(&rec, time(NULL))) {
+		LOG(Verbosity_DEBUG, "Metadata cache entry for %s has expired\n", path);
+		return false;
+	}
+	struct stat st;
+	if (stat(path, &st) != 0 || st.st_mtime != rec.mtime || st.st_size != rec.size) {
+		LOG(Verbosity_DEBUG, "Metadata cache entry for %s is stale\n", path);
+		return false;
+	}
+
+	memset(entry, 0, sizeof(MetaCacheEntry));
+	TrackMeta_init(&entry->meta);
+	strings += rec.path_len;
+	struct {
+		uint32_t len;
+		char **tag;
+		size_t *tag_len;
+	} tags[] = {
+		{rec.name_len, &entry->meta.name, &entry->meta.name_len},
+		{rec.artist_len, &entry->meta.artist, &entry->meta.artist_len},
+		{rec.album_len, &entry->meta.album, &entry->meta.album_len},
+	};
+	for (size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+		if (tags[i].len == METACACHE_NO_TAG) {
+			continue;
+		}
+		*tags[i].tag = strndup(strings, tags[i].len);
+		if (!*tags[i].tag) {
+			TrackMeta_deinit(&entry->meta);
+			return false;
+		}
+		*tags[i].tag_len = tags[i].len;
+		strings += tags[i].len;
+	}
+	entry->src_pcm.sample_fmt = rec.sample_fmt;
+	entry->src_pcm.sample_rate = rec.sample_rate;
+	entry->src_pcm.n_channels = rec.n_channels;
+	entry->duration = rec.duration;
+	entry->start_padding = rec.start_padding;
+	entry->end_padding = rec.end_padding;
+	entry->codec_id = rec.codec_id;
+
+	return true;
+#endif
+}
+
+void MetaCache_put(MetaCache *mc, const char *url, const MetaCacheEntry *entry) {
+#ifndef __WIN32
+	const char *path = path_from_url(url);
+	struct stat st;
+	if (!path || stat(path, &st) != 0) {
+		return;
+	}
+
+	struct MetaCacheRecord rec = {
+		.mtime = st.st_mtime,
+		.size = st.st_size,
+		.cached_at = time(NULL),
+		.duration = entry->duration,
+		.start_padding = entry->start_padding,
+		.end_padding = entry->end_padding,
+		.codec_id = entry->codec_id,
+		.sample_fmt = entry->src_pcm.sample_fmt,
+		.sample_rate = entry->src_pcm.sample_rate,
+		.n_channels = entry->src_pcm.n_channels,
+		.path_len = strlen(path),
+		.name_len = entry->meta.name ? entry->meta.name_len : METACACHE_NO_TAG,
+		.artist_len = entry->meta.artist ? entry->meta.artist_len : METACACHE_NO_TAG,
+		.album_len = entry->meta.album ? entry->meta.album_len : METACACHE_NO_TAG,
+	};
+	const size_t size = MetaCache_record_size(&rec);
+	unsigned char *data = calloc(1, size);
+	if (!data) {
+		return;
+	}
+	memcpy(data, &rec, sizeof(rec));
+	unsigned char *strings = data + sizeof(rec);
+	memcpy(strings, path, rec.path_len);
+	strings += rec.path_len;
+	const char *tags[] = {entry->meta.name, entry->meta.artist, entry->meta.album};
+	const uint32_t tag_lens[] = {rec.name_len, rec.artist_len, rec.album_len};
+	for (size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+		if (tags[i]) {
+			memcpy(strings, tags[i], tag_lens[i]);
+			strings += tag_lens[i];
+		}
+	}
+
+	pthread_mutex_lock(&mc->lock);
+	if (mc->n_new == mc->cap_new) {
+		const size_t cap = mc->cap_new ? mc->cap_new * 2 : 64;
+		MetaCachePacked *new_entries = realloc(mc->new_entries, cap * sizeof(MetaCachePacked));
+		if (!new_entries) {
+			pthread_mutex_unlock(&mc->lock);
+			free(data);
+			return;
+		}
+		mc->new_entries = new_entries;
+		mc->cap_new = cap;
+	}
+	mc->new_entries[mc->n_new++] = (MetaCachePacked){
+		.hash = MetaCache_hash(path, rec.path_len),
+		.data = data,
+		.size = size
+	};
+	pthread_mutex_unlock(&mc->lock);
+#endif
+}
+
+#ifndef __WIN32
+// An entry being merged into the cache file, along with its rank among entries for the same path (the lowest wins)
+typedef struct MetaCacheMerge {
+	MetaCachePacked packed;
+	size_t rank;
+} MetaCacheMerge;
+
+// Order packed entries by hash, then path
+static int MetaCachePacked_cmp(const MetaCachePacked *a, const MetaCachePacked *b) {
+	if (a->hash != b->hash) {
+		return a->hash < b->hash ? -1 : 1;
+	}
+	struct MetaCacheRecord rec_a, rec_b;
+	memcpy(&rec_a, a->data, sizeof(rec_a));
+	memcpy(&rec_b, b->data, sizeof(rec_b));
+	const size_t len = rec_a.path_len < rec_b.path_len ? rec_a.path_len : rec_b.path_len;
+	const int cmp = memcmp(a->data + sizeof(rec_a), b->data + sizeof(rec_b), len);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return rec_a.path_len < rec_b.path_len ? -1 : rec_a.path_len > rec_b.path_len;
+}
+
+// Order entries by hash, then path, then rank
+static int MetaCacheMerge_cmp(const void *a_, const void *b_) {
+	const MetaCacheMerge *a = a_, *b = b_;
+	const int cmp = MetaCachePacked_cmp(&a->packed, &b->packed);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return a->rank < b->rank ? -1 : a->rank > b->rank;
+}
+
+// Write entries (sorted and deduplicated) to a new cache file at *path
+static int MetaCache_write(const char *path, const MetaCacheMerge *entries, size_t n_entries) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		LOG(Verbosity_DEBUG, "Failed to open %s for writing\n", path);
+		return 1;
+	}
+
+	struct MetaCacheFileHeader hdr = {.version = METACACHE_VERSION, .n_entries = n_entries};
+	memcpy(hdr.magic, METACACHE_MAGIC, sizeof(METACACHE_MAGIC));
+	hdr.size = sizeof(hdr) + n_entries * sizeof(struct MetaCacheIndexEntry);
+	for (size_t i = 0; i < n_entries; i++) {
+		hdr.size += entries[i].packed.size;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	uint64_t offset = sizeof(hdr) + n_entries * sizeof(struct MetaCacheIndexEntry);
+	for (size_t i = 0; ok && i < n_entries; i++) {
+		const struct MetaCacheIndexEntry index_entry = {.hash = entries[i].packed.hash, .offset = offset};
+		ok = fwrite(&index_entry, sizeof(index_entry), 1, fp) == 1;
+		offset += entries[i].packed.size;
+	}
+	for (size_t i = 0; ok && i < n_entries; i++) {
+		ok = fwrite(entries[i].packed.data, 1, entries[i].packed.size, fp) == entries[i].packed.size;
+	}
+
+	return fclose(fp) == 0 && ok ? 0 : 1;
+}
+
+// Merge new entries into the cache file as it is on disk now (other instances may have saved since we mapped it),
+// replacing it atomically.
+static void MetaCache_save(MetaCache *mc) {
+	path_mkdir_parents(mc->path);
+
+	// Serialize saves between instances, so none of them drops entries another just saved
+	const size_t path_len = strlen(mc->path);
+	char lock_path[path_len + sizeof(".lock")];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", mc->path);
+	char tmp_path[path_len + sizeof(".tmp")];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", mc->path);
+	const int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+		LOG(Verbosity_DEBUG, "Failed to lock %s, not saving metadata cache\n", lock_path);
+		if (lock_fd >= 0) {
+			close(lock_fd);
+		}
+		return;
+	}
+
+	size_t disk_size = 0, n_disk = 0;
+	const struct MetaCacheIndexEntry *disk_index = NULL;
+	void *disk = MetaCache_map(mc->path, &disk_size, &disk_index, &n_disk);
+
+	MetaCacheMerge *entries = malloc((mc->n_new + n_disk) * sizeof(MetaCacheMerge));
+	if (!entries) {
+		goto out;
+	}
+	// Newer entries outrank older ones for the same path
+	size_t n_entries = 0;
+	for (size_t i = 0; i < mc->n_new; i++) {
+		entries[n_entries++] = (MetaCacheMerge){.packed = mc->new_entries[i], .rank = mc->n_new - i};
+	}
+	// Expired entries are dropped, so the file doesn't keep growing with entries for deleted tracks.
+	// (Entries for changed tracks are replaced once the tracks are probed again)
+	const int64_t now = time(NULL);
+	size_t n_expired = 0;
+	for (size_t i = 0; i < n_disk; i++) {
+		struct MetaCacheRecord rec;
+		if (!MetaCache_record(disk, disk_size, disk_index[i].offset, &rec)
+				|| disk_index[i].offset + MetaCache_record_size(&rec) > disk_size) {
+			continue;
+		}
+		if (MetaCache_expired(&rec, now)) {
+			n_expired++;
+			continue;
+		}
+		entries[n_entries++] = (MetaCacheMerge){
+			.packed = {
+				.hash = disk_index[i].hash,
+				.data = (unsigned char *)disk + disk_index[i].offset,
+				.size = MetaCache_record_size(&rec)
+			},
+			.rank = mc->n_new + 1
+		};
+	}
+	qsort(entries, n_entries, sizeof(MetaCacheMerge), MetaCacheMerge_cmp);
+	size_t n_kept = 0;
+	for (size_t i = 0; i < n_entries; i++) {
+		if (n_kept == 0 || MetaCachePacked_cmp(&entries[n_kept-1].packed, &entries[i].packed) != 0) {
+			entries[n_kept++] = entries[i];
+		}
+	}
+
+	// Write to a temporary file and move it into place, so instances mapping the cache never see a partial file
+	if (MetaCache_write(tmp_path, entries, n_kept) == 0 && rename(tmp_path, mc->path) == 0) {
+		LOG(Verbosity_DEBUG, "Saved metadata cache %s (%zu entries, %zu expired ones dropped)\n", mc->path, n_kept, n_expired);
+	} else {
+		remove(tmp_path);
+	}
+	free(entries);
+
+out:
+	if (disk) {
+		munmap(disk, disk_size);
+	}
+	flock(lock_fd, LOCK_UN);
+	close(lock_fd);
+}
+#endif
+
+void MetaCache_close(MetaCache *mc) {
+#ifndef __WIN32
+	if (mc->n_new > 0) {
+		MetaCache_save(mc);
+	}
+	if (mc->map) {
+		munmap(mc->map, mc->map_size);
+	}
+#endif
+	for (size_t i = 0; i < mc->n_new; i++) {
+		free(mc->new_entries[i].data);
+	}
+	free(mc->new_entries);
+	pthread_mutex_destroy(&mc->lock);
+	free(mc->path);
+	free(mc);
+}
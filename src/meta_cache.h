@@ -0,0 +1,40 @@
+#pragma once
+#include "track_meta.h"
+#include "audio/pcm.h"
+
+#include <libavcodec/codec_id.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// What probing a track finds out about it, as cached by a MetaCache
+typedef struct MetaCacheEntry {
+	TrackMeta meta;
+	AudioPCM src_pcm; // PCM format the track decodes to (before any resampling)
+	int64_t duration; // Duration in src_pcm sample frames
+	size_t start_padding, end_padding; // Sample frames of padding at the start and end of the track
+	enum AVCodecID codec_id;
+} MetaCacheEntry;
+
+// An on-disk cache of track metadata and stream info ($XDG_CACHE_HOME/mpl/meta.cache), so queueing tracks
+// that have been probed before doesn't have to open them at all.
+// Entries are keyed by the track's path, and only hit while the file's size and mtime match those it was cached with,
+// and for a few months after they were cached (after which they're dropped, so those of deleted tracks don't pile up).
+// The cache file is mapped into memory when the cache is opened, so a hit costs a stat() of the track and nothing else.
+// New entries are held in memory until MetaCache_close(), which merges them with the cache file as it is on disk by then
+// and replaces it atomically, so several mpl instances can share it.
+typedef struct MetaCache MetaCache;
+
+// Open the cache, mapping its file into memory if there is one (a missing, outdated or corrupt cache file starts it empty).
+// Returns NULL if there's nowhere to cache to (or on allocation failure).
+MetaCache *MetaCache_open(void);
+// Save new entries to the cache file, then unmap it and free *mc
+void MetaCache_close(MetaCache *mc);
+
+// Look up the track at url, filling in *entry on a hit. entry->meta is allocated (see TrackMeta_deinit()).
+// Returns whether an entry matching the track file's current size and mtime was found.
+// Safe to call from any thread.
+bool MetaCache_get(MetaCache *mc, const char *url, MetaCacheEntry *entry);
+// Add an entry for the track at url (replacing any existing one once saved). Tracks that aren't local files aren't cached.
+// Safe to call from any thread.
+void MetaCache_put(MetaCache *mc, const char *url, const MetaCacheEntry *entry);
@@ -1,22 +1,66 @@
 #include "track.h"
 #include "audio/track.h"
 #include "error.h"
+#include "meta_cache.h"
 #include "track_meta.h"
 #include "ui/fmt.h"
 #include "util/compat/string_win32.h"
 #include "util/log.h"
 
+#include <libavutil/mathematics.h>
 #include <stdatomic.h>
 #include <string.h>
 
-Track *Track_new(const char *url, const size_t url_len, AudioBackend *ab) {
+// Fill in t's cached audio info from a MetaCache entry, as probing the track would have
+static void Track_from_cache(Track *t, MetaCacheEntry *entry) {
+	t->meta = entry->meta;
+	// Tracks are buffered in the PCM format they'd be resampled to (see AudioTrack_init())
+#ifdef MPL_RESAMPLE
+	AudioBackend_negotiate_pcm(t->ab, &t->pcm, &entry->src_pcm);
+#else
+	t->pcm = entry->src_pcm;
+#endif
+	t->duration = entry->duration;
+	if (t->pcm.sample_rate != entry->src_pcm.sample_rate) {
+		t->duration = av_rescale(entry->duration, t->pcm.sample_rate, entry->src_pcm.sample_rate);
+	}
+}
+
+// Add t's probed audio info to *cache
+static void Track_to_cache(const Track *t, MetaCache *cache) {
+	const AudioTrack *at = &t->audio;
+	MetaCacheEntry entry = {
+		.meta = t->meta,
+		.src_pcm = at->src_pcm,
+		.duration = t->duration,
+		.start_padding = at->start_padding,
+		.end_padding = at->end_padding,
+		.codec_id = at->codec->id
+	};
+	if (at->src_pcm.sample_rate != at->buf_pcm.sample_rate) {
+		entry.duration = av_rescale(t->duration, at->src_pcm.sample_rate, at->buf_pcm.sample_rate);
+	}
+	MetaCache_put(cache, t->url, &entry);
+}
+
+Track *Track_new(const char *url, const size_t url_len, AudioBackend *ab, const Settings *settings, MetaCache *cache) {
 	Track *t = malloc(sizeof(Track));
 	CHECK_ALLOC(t, NULL);
+	memset(t, 0, sizeof(Track));
 	t->url_len = url_len;
 	t->url = strndup(url, url_len);
+	t->ab = ab;
+	t->settings = settings;
 
-	// Initialize track audio (which also decodes streams needed for metadata)
-	enum AudioTrack_ERR at_err = AudioTrack_init(&t->audio, t->url, ab);
+	MetaCacheEntry entry;
+	if (cache && MetaCache_get(cache, t->url, &entry)) {
+		Track_from_cache(t, &entry);
+		LOG(Verbosity_DEBUG, "Found track %s in metadata cache\n", t->url);
+		return t;
+	}
+
+	// Open track audio (which also decodes streams needed for metadata)
+	enum AudioTrack_ERR at_err = Track_open(t, NULL);
 	if (at_err != AudioTrack_OK) {
 		LOG(Verbosity_NORMAL, "Failed to initialize AudioTrack %s - %s\n", t->url, AudioTrack_ERR_name(at_err));
 		free(t->url);
@@ -29,18 +73,54 @@ Track *Track_new(const char *url, const size_t url_len, AudioBackend *ab) {
 	if (at_err != AudioTrack_OK) {
 		LOG(Verbosity_DEBUG, "Failed to get metadata for AudioTrack %s: %s\n", t->url, AudioTrack_ERR_name(at_err));
 	}
+	t->pcm = t->audio.buf_pcm;
+	t->duration = t->audio.duration_timecode;
+	if (cache) {
+		Track_to_cache(t, cache);
+	}
+
+	// The TrackQueue reopens the track once it's about to be played
+	Track_close(t);
 
 	return t;
 }
 void Track_free(Track *t) {
+	Track_close(t);
 	free(t->url);
 	t->url = NULL;
 	t->url_len = 0;
-	AudioTrack_deinit(&t->audio);
 	TrackMeta_deinit(&t->meta);
 	free(t);
 }
 
+enum AudioTrack_ERR Track_open(Track *t, AudioFileData *file_data) {
+	if (t->open) {
+		if (file_data) {
+			AudioFileData_unref(file_data);
+		}
+		return AudioTrack_OK;
+	}
+
+	enum AudioTrack_ERR at_err = AudioTrack_init(&t->audio, t->url, t->ab, t->settings, file_data);
+	if (at_err != AudioTrack_OK) {
+		AudioTrack_deinit(&t->audio);
+		return at_err;
+	}
+	LOG(Verbosity_DEBUG, "Opened track %s%s\n", t->url, file_data ? " from memory" : "");
+	t->open = true;
+	return AudioTrack_OK;
+}
+
+void Track_close(Track *t) {
+	if (!t->open) {
+		return;
+	}
+
+	AudioTrack_deinit(&t->audio);
+	LOG(Verbosity_DEBUG, "Closed track %s\n", t->url);
+	t->open = false;
+}
+
 int Track_fmt(const Track *t, Formatter *fmt) {
 	int n = 0; // # of bytes written
 
@@ -1,8 +1,12 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "meta_cache.h"
 #include "track_meta.h"
+#include "audio/pcm.h"
 #include "audio/track.h"
+#include "ui/event.h"
 #include "ui/fmt.h"
 
 
@@ -13,15 +17,31 @@ typedef struct Track {
 
 	// Track metadata
 	TrackMeta meta;
+	// Audio info cached from probing the track, so it's available while the track is closed
+	AudioPCM pcm; // PCM format the track is buffered in
+	EventBody_Timecode duration; // Duration in sample frames
 
-	// Audio info
+	// Audio decoding state. Only initialized while the track is open (see Track_open())
 	AudioTrack audio;
+	bool open;
+	// What the track is opened with
+	AudioBackend *ab;
+	const Settings *settings;
 } Track;
 
-// As of v0.4.10, this DOES initialize track audio and metadata.
-// This does NOT initialize track audio BUFFERING. The TrackQueue is in charge of managing that in a memory-efficient manner.
-Track *Track_new(const char *url, const size_t url_len, AudioBackend *ab);
+// Probe the track at url for its metadata, then close it again so queued tracks don't hold on to files or decoders.
+// Tracks found in *cache (if it isn't NULL) aren't opened at all, and tracks that had to be probed are added to it.
+// Returns NULL if the track can't be played.
+// This does NOT initialize track audio. The TrackQueue opens tracks (and their buffers) as they enter the playback window.
+Track *Track_new(const char *url, const size_t url_len, AudioBackend *ab, const Settings *settings, MetaCache *cache);
 
 void Track_free(Track *t);
 
+// Open t's demuxer + decoder (t->audio) for playback, if it isn't already open.
+// The track's file is read from file_data if it isn't NULL. This takes over the caller's reference to file_data.
+enum AudioTrack_ERR Track_open(Track *t, AudioFileData *file_data);
+// Close t's demuxer + decoder along with its buffers, if it's open.
+// NOTE: nothing may be buffering or playing t when this is called
+void Track_close(Track *t);
+
 int Track_fmt(const Track *t, Formatter *fmt);
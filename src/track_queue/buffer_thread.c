@@ -25,7 +25,11 @@ static void BufferThread_wake(void *ud) {
 	AudioTrack *tr = thr->track;
 	if (tr) {
 		// the BufferThread might be sleeping waiting for a buffer read
-		sem_post(&tr->buffer->rd_sem);
+		AudioBuffer_wake(tr->buffer);
+		// or decoding a whole buffer's worth of segments
+		if (tr->segments) {
+			SegmentDecoder_cancel(tr->segments);
+		}
 	}
 }
 
@@ -55,11 +59,22 @@ void BufferThread_free(BufferThread *thr) {
 	free(thr);
 }
 
+// Clear a segment decoding cancel left over from the last iteration of BufferThread_routine().
+// This is done before ThreadRC_preloop(), never after it: a lock requested between the two is then taken by ThreadRC_preloop(),
+// and one requested later still cancels the decoding that follows. (The cost is that the wake from unlocking
+// after a lock taken by ThreadRC_preloop() cancels one fill, which falls back to decoding a packet sequentially)
+static void BufferThread_reset_cancel(BufferThread *thr) {
+	AudioTrack *tr = thr->track;
+	if (tr && tr->segments) {
+		SegmentDecoder_reset_cancel(tr->segments);
+	}
+}
+
 static void *BufferThread_routine(void *args) {
 	BufferThread *thr = args;
 
 	// Start buffering from thr->track
-	while (ThreadRC_preloop(thr->thread_rc)) {
+	for (; ThreadRC_preloop(thr->thread_rc); BufferThread_reset_cancel(thr)) {
 		AudioTrack *track = thr->track;
 		if (track == NULL) {
 			ThreadRC_selflock(thr->thread_rc, 0, "No track");
@@ -67,28 +82,37 @@ static void *BufferThread_routine(void *args) {
 		}
 
 		static const AudioTrack *tr_cached = NULL;
-		static size_t buf_ahead_max = 0;
 		static size_t prebuf_frames = 0;
 		const bool prebuf = thr->prebuf_ms > 0;
 		if (tr_cached != track) {
 			tr_cached = track;
-			buf_ahead_max = track->buffer->size/2;
 			prebuf_frames = prebuf ? thr->prebuf_ms : 0;
 		}
 
-		const int rd = atomic_load(&track->buffer->rd);
-		const int wr = atomic_load(&track->buffer->wr);
-		// Keep half the buffer full of past frames to enable bidirectional buffer seeks 
-		if (!prebuf && AudioBuffer_max_read(track->buffer, rd, wr, false) >= buf_ahead_max) {
-			// We sleep here, so it's crucial to post this semaphore
+		// Once we've buffered up to the high watermark, use the time to read compressed packets ahead.
+		// When we're far enough ahead, sleep until playback drains the buffer to its low watermark,
+		// then refill it in one burst
+		if (!prebuf && AudioBuffer_max_read(track->buffer, false) >= track->buffer->high_watermark) {
+			if (AudioTrack_read_ahead(track)) {
+				continue;
+			}
+			// We sleep here, so it's crucial to wake the buffer
 			// in the anti-deadlock for our ThreadRC.
-			sem_wait(&track->buffer->rd_sem);
+			AudioBuffer_wait_drain(track->buffer, track->buffer->low_watermark);
 			continue;
 		}
 
-		enum AudioTrack_ERR at_err = AudioTrack_buffer_packet(track, NULL);
+		// After a seek or track change, fill the buffer in parallel segments if we can
+		size_t n_bytes = 0;
+		enum AudioTrack_ERR at_err = AudioTrack_OK;
+		if (!prebuf) {
+			at_err = AudioTrack_buffer_segments(track, &n_bytes);
+		}
+		if (at_err == AudioTrack_OK && n_bytes == 0) {
+			at_err = AudioTrack_buffer_packet(track, NULL);
+		}
 		if (prebuf) {
-			if (at_err == AudioTrack_OK && track->buffer->n_written >= prebuf_frames) {
+			if (at_err == AudioTrack_OK && AudioBuffer_n_written(track->buffer) >= prebuf_frames) {
 				at_err = AudioTrack_PREBUF_EOF;
 			}
 		}
@@ -0,0 +1,242 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_prefetch.h"
+#include "audio/io.h"
+#include "error.h"
+#include "util/compat/string_win32.h"
+#include "util/log.h"
+#include "util/path.h"
+
+// Files are read in chunks of this many bytes, checking in between whether they're still wanted
+static const size_t PREFETCH_CHUNK = 1 << 20;
+
+// A file the FilePrefetcher has been asked to hold
+typedef struct PrefetchFile {
+	char *url;
+	AudioFileData *data; // File contents, NULL until read
+	bool failed; // Whether the file couldn't be read (so we don't retry it)
+	bool no_room; // Whether the file didn't fit in the budget when we got to it (retried whenever wanted files change)
+} PrefetchFile;
+
+struct FilePrefetcher {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Signalled when wanted files change, or on shutdown
+	bool shutdown;
+
+	PrefetchFile *files; // Wanted files, in order of priority
+	size_t n_files;
+	size_t budget;
+	size_t used; // Bytes of files held
+
+	const char *reading; // URL of the file being read (owned by the thread), or NULL
+	atomic_bool abandon; // Set when the file being read is no longer wanted
+};
+
+// Find the wanted file for url. Returns NULL if it isn't wanted
+// NOTE: fp->lock must be held
+static PrefetchFile *FilePrefetcher_find(FilePrefetcher *fp, const char *url) {
+	for (size_t i = 0; i < fp->n_files; i++) {
+		if (fp->files[i].url && strcmp(fp->files[i].url, url) == 0) {
+			return &fp->files[i];
+		}
+	}
+	return NULL;
+}
+
+// Read the whole file at path into memory, unless it's bigger than max_size bytes.
+// Returns NULL if it can't be read, was abandoned, or (setting *too_big) doesn't fit
+static AudioFileData *FilePrefetcher_read(FilePrefetcher *fp, const char *path, size_t max_size, bool *too_big) {
+	*too_big = false;
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	const long size = ftell(f);
+	if (size <= 0 || (size_t)size > max_size) {
+		*too_big = size > 0;
+		fclose(f);
+		return NULL;
+	}
+	rewind(f);
+
+	unsigned char *data = malloc(size);
+	size_t n_read = 0;
+	while (data && n_read < (size_t)size && !atomic_load_explicit(&fp->abandon, memory_order_relaxed)) {
+		const size_t n = (size_t)size - n_read < PREFETCH_CHUNK ? (size_t)size - n_read : PREFETCH_CHUNK;
+		if (fread(data + n_read, 1, n, f) != n) {
+			break;
+		}
+		n_read += n;
+	}
+	fclose(f);
+
+	AudioFileData *file_data = n_read == (size_t)size ? AudioFileData_new(data, size) : NULL;
+	if (!file_data) {
+		free(data);
+	}
+	return file_data;
+}
+
+static void *FilePrefetcher_routine(void *args) {
+	FilePrefetcher *fp = args;
+
+	pthread_mutex_lock(&fp->lock);
+	while (!fp->shutdown) {
+		// Read the first wanted file we don't have yet
+		PrefetchFile *file = NULL;
+		for (size_t i = 0; i < fp->n_files && !file; i++) {
+			if (!fp->files[i].data && !fp->files[i].failed && !fp->files[i].no_room) {
+				file = &fp->files[i];
+			}
+		}
+		if (!file) {
+			pthread_cond_wait(&fp->cond, &fp->lock);
+			continue;
+		}
+		char *url = strdup(file->url);
+		if (!url || !path_from_url(url)) {
+			file->failed = true;
+			free(url);
+			continue;
+		}
+		fp->reading = url;
+		atomic_store(&fp->abandon, false);
+		const size_t max_size = fp->budget - fp->used;
+		pthread_mutex_unlock(&fp->lock);
+
+		bool too_big;
+		AudioFileData *data = FilePrefetcher_read(fp, path_from_url(url), max_size, &too_big);
+
+		pthread_mutex_lock(&fp->lock);
+		fp->reading = NULL;
+		// Wanted files may have changed while we were reading
+		file = FilePrefetcher_find(fp, url);
+		if (file && data && AudioFileData_size(data) <= fp->budget - fp->used) {
+			file->data = data;
+			fp->used += AudioFileData_size(data);
+			LOG(Verbosity_VERBOSE, "Prefetched %s (%.1f MiB)\n", url, AudioFileData_size(data) / (1024.0 * 1024.0));
+		} else {
+			if (file) {
+				file->no_room = too_big || data;
+				file->failed = !file->no_room && !atomic_load(&fp->abandon);
+			}
+			if (data) {
+				AudioFileData_unref(data);
+			}
+		}
+		free(url);
+	}
+	pthread_mutex_unlock(&fp->lock);
+
+	return NULL;
+}
+
+FilePrefetcher *FilePrefetcher_new(size_t budget) {
+	FilePrefetcher *fp = malloc(sizeof(FilePrefetcher));
+	CHECK_ALLOC(fp, NULL);
+	memset(fp, 0, sizeof(FilePrefetcher));
+	fp->budget = budget;
+	atomic_init(&fp->abandon, false);
+	pthread_mutex_init(&fp->lock, NULL);
+	pthread_cond_init(&fp->cond, NULL);
+
+	if (pthread_create(&fp->thread, NULL, FilePrefetcher_routine, fp) != 0) {
+		pthread_cond_destroy(&fp->cond);
+		pthread_mutex_destroy(&fp->lock);
+		free(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+// Free a wanted file's URL, and drop our reference to its contents
+static void PrefetchFile_deinit(PrefetchFile *file) {
+	free(file->url);
+	if (file->data) {
+		AudioFileData_unref(file->data);
+	}
+}
+
+void FilePrefetcher_free(FilePrefetcher *fp) {
+	pthread_mutex_lock(&fp->lock);
+	fp->shutdown = true;
+	atomic_store(&fp->abandon, true);
+	pthread_cond_broadcast(&fp->cond);
+	pthread_mutex_unlock(&fp->lock);
+	pthread_join(fp->thread, NULL);
+
+	for (size_t i = 0; i < fp->n_files; i++) {
+		PrefetchFile_deinit(&fp->files[i]);
+	}
+	free(fp->files);
+	pthread_cond_destroy(&fp->cond);
+	pthread_mutex_destroy(&fp->lock);
+	free(fp);
+}
+
+int FilePrefetcher_want(FilePrefetcher *fp, const char *const *urls, size_t n_urls) {
+	PrefetchFile *files = calloc(n_urls ? n_urls : 1, sizeof(PrefetchFile));
+	CHECK_ALLOC(files, 1);
+
+	pthread_mutex_lock(&fp->lock);
+	// Carry over the files we already have (or have given up on), and start the rest from scratch
+	size_t n_files = 0;
+	for (size_t i = 0; i < n_urls; i++) {
+		bool dup = false;
+		for (size_t j = 0; j < n_files && !dup; j++) {
+			dup = strcmp(files[j].url, urls[i]) == 0;
+		}
+		if (dup) {
+			continue;
+		}
+		PrefetchFile *old = FilePrefetcher_find(fp, urls[i]);
+		if (old) {
+			files[n_files] = *old;
+			old->url = NULL;
+			old->data = NULL;
+		} else {
+			files[n_files].url = strdup(urls[i]);
+			if (!files[n_files].url) {
+				continue;
+			}
+		}
+		// Budget may have been freed up since
+		files[n_files].no_room = false;
+		n_files++;
+	}
+	for (size_t i = 0; i < fp->n_files; i++) {
+		if (fp->files[i].data) {
+			fp->used -= AudioFileData_size(fp->files[i].data);
+		}
+		PrefetchFile_deinit(&fp->files[i]);
+	}
+	free(fp->files);
+	fp->files = files;
+	fp->n_files = n_files;
+	if (fp->reading && !FilePrefetcher_find(fp, fp->reading)) {
+		atomic_store(&fp->abandon, true);
+	}
+	pthread_cond_broadcast(&fp->cond);
+	pthread_mutex_unlock(&fp->lock);
+
+	return 0;
+}
+
+AudioFileData *FilePrefetcher_get(FilePrefetcher *fp, const char *url) {
+	pthread_mutex_lock(&fp->lock);
+	const PrefetchFile *file = FilePrefetcher_find(fp, url);
+	AudioFileData *data = file && file->data ? AudioFileData_ref(file->data) : NULL;
+	pthread_mutex_unlock(&fp->lock);
+	return data;
+}
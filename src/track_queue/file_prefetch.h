@@ -0,0 +1,23 @@
+#pragma once
+#include "audio/io.h"
+
+#include <stddef.h>
+
+// Reads whole track files into memory on a background thread, ahead of them being played,
+// so opening them later is served from RAM (see AudioFileData) rather than waiting on slow or sleeping storage.
+// The TrackQueue tells it which files it wants held, in order of priority. Files are read in that order,
+// for as many as fit in a byte budget, and dropped once they're no longer wanted (and nothing's reading them).
+typedef struct FilePrefetcher FilePrefetcher;
+
+// Allocate a new FilePrefetcher, holding at most budget bytes of files at once. Returns NULL on error
+FilePrefetcher *FilePrefetcher_new(size_t budget);
+// Stop reading files, then join and free a FilePrefetcher. Files still being read from stay alive until they're closed
+void FilePrefetcher_free(FilePrefetcher *fp);
+
+// Set the files to hold in memory to the n_urls local files at urls, in order of priority.
+// Files held that aren't among them are dropped, and any not yet held are read in the background.
+// URLs are copied, so the caller keeps ownership of urls.
+// Returns 0 on success, nonzero on error
+int FilePrefetcher_want(FilePrefetcher *fp, const char *const *urls, size_t n_urls);
+// Get a new reference to the contents of the file at url, or NULL if it isn't held in memory (yet)
+AudioFileData *FilePrefetcher_get(FilePrefetcher *fp, const char *url);
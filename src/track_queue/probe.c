@@ -0,0 +1,219 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/cpu.h>
+
+#include "probe.h"
+#include "error.h"
+#include "track.h"
+#include "ui/event.h"
+#include "ui/event_queue.h"
+#include "util/compat/string_win32.h"
+#include "util/log.h"
+
+// # of probe threads per CPU core. Probing mostly waits on I/O (i.e from network shares), so we oversubscribe.
+static const int PROBE_THREADS_PER_CORE = 2;
+
+// A batch of tracks to probe, queued by one ProbePool_probe() call
+typedef struct ProbeBatch {
+	char **urls;
+	size_t n_urls;
+	Track **tracks; // Probed tracks not yet sent, NULL where probing failed
+	bool *probed; // Whether each track has been probed
+	size_t next_probe; // Index of the next URL to hand out to a thread
+	size_t next_send; // Index of the next track to send, once it's been probed
+	size_t n_sent; // # of playable tracks sent
+	EventSubQueue *evt_sq; // Sized to hold every track in the batch, so sending never blocks
+	struct ProbeBatch *next;
+} ProbeBatch;
+
+struct ProbePool {
+	pthread_t *threads;
+	size_t n_threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Signalled when a batch is queued, or the pool is shutting down
+	ProbeBatch *head; // Batches with tracks left to send, oldest first
+	bool shutdown;
+
+	// What tracks are probed with
+	AudioBackend *ab;
+	const Settings *settings;
+	MetaCache *cache;
+};
+
+// Free a ProbeBatch, along with any tracks it hasn't sent
+static void ProbeBatch_free(ProbeBatch *batch) {
+	for (size_t i = 0; i < batch->n_urls; i++) {
+		if (batch->urls) {
+			free(batch->urls[i]);
+		}
+		if (batch->tracks && batch->tracks[i]) {
+			Track_free(batch->tracks[i]);
+		}
+	}
+	free(batch->urls);
+	free(batch->tracks);
+	free(batch->probed);
+	free(batch);
+}
+
+// Send every track of *batch that's been probed, up to the first one that hasn't, and free the batch once it's all sent.
+// NOTE: pool->lock must be held
+static void ProbePool_send(ProbePool *pool, ProbeBatch *batch) {
+	while (batch->next_send < batch->n_urls && batch->probed[batch->next_send]) {
+		Track *t = batch->tracks[batch->next_send];
+		batch->tracks[batch->next_send] = NULL;
+		batch->next_send++;
+		if (!t) {
+			continue;
+		}
+
+		// The receiver takes ownership of the track
+		const Event evt = {
+			.event_type = mpl_TRACK_PROBED,
+			.body_size = sizeof(Track),
+			.body = t
+		};
+		EventSubQueue_send(batch->evt_sq, &evt, false);
+		batch->n_sent++;
+	}
+	if (batch->next_send < batch->n_urls) {
+		return;
+	}
+
+	if (batch->n_sent == 0) {
+		LOG(Verbosity_NORMAL, "None of the %zu tracks queued could be opened\n", batch->n_urls);
+	} else {
+		LOG(Verbosity_VERBOSE, "Probed %zu tracks (%zu playable)\n", batch->n_urls, batch->n_sent);
+	}
+	ProbeBatch **link = &pool->head;
+	while (*link != batch) {
+		link = &(*link)->next;
+	}
+	*link = batch->next;
+	ProbeBatch_free(batch);
+}
+
+static void *ProbePool_routine(void *args) {
+	ProbePool *pool = args;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->shutdown) {
+		// Take the next URL from the oldest batch that has any left
+		ProbeBatch *batch = pool->head;
+		while (batch && batch->next_probe == batch->n_urls) {
+			batch = batch->next;
+		}
+		if (!batch) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		const size_t i = batch->next_probe++;
+		pthread_mutex_unlock(&pool->lock);
+
+		Track *t = Track_new(batch->urls[i], strlen(batch->urls[i]), pool->ab, pool->settings, pool->cache);
+
+		pthread_mutex_lock(&pool->lock);
+		batch->tracks[i] = t;
+		batch->probed[i] = true;
+		ProbePool_send(pool, batch);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+ProbePool *ProbePool_new(AudioBackend *ab, const Settings *settings, MetaCache *cache) {
+	ProbePool *pool = malloc(sizeof(ProbePool));
+	CHECK_ALLOC(pool, NULL);
+	memset(pool, 0, sizeof(ProbePool));
+	pool->ab = ab;
+	pool->settings = settings;
+	pool->cache = cache;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	const size_t n_threads = av_cpu_count() * PROBE_THREADS_PER_CORE;
+	pool->threads = malloc(n_threads * sizeof(pthread_t));
+	if (!pool->threads) {
+		ProbePool_free(pool);
+		return NULL;
+	}
+	for (; pool->n_threads < n_threads; pool->n_threads++) {
+		if (pthread_create(&pool->threads[pool->n_threads], NULL, ProbePool_routine, pool) != 0) {
+			break;
+		}
+	}
+	if (pool->n_threads == 0) {
+		ProbePool_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void ProbePool_free(ProbePool *pool) {
+	// Threads finish the track they're probing, then exit
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (size_t i = 0; i < pool->n_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+
+	while (pool->head) {
+		ProbeBatch *next = pool->head->next;
+		ProbeBatch_free(pool->head);
+		pool->head = next;
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int ProbePool_probe(ProbePool *pool, EventQueue *eq, const char *const *urls, size_t n_urls) {
+	if (n_urls == 0) {
+		return 0;
+	}
+
+	ProbeBatch *batch = malloc(sizeof(ProbeBatch));
+	CHECK_ALLOC(batch, 1);
+	memset(batch, 0, sizeof(ProbeBatch));
+	batch->n_urls = n_urls;
+	batch->urls = calloc(n_urls, sizeof(char *));
+	batch->tracks = calloc(n_urls, sizeof(Track *));
+	batch->probed = calloc(n_urls, sizeof(bool));
+	if (!batch->urls || !batch->tracks || !batch->probed) {
+		ProbeBatch_free(batch);
+		return 1;
+	}
+	for (size_t i = 0; i < n_urls; i++) {
+		batch->urls[i] = strdup(urls[i]);
+		if (!batch->urls[i]) {
+			ProbeBatch_free(batch);
+			return 1;
+		}
+	}
+	batch->evt_sq = EventQueue_connect(eq, n_urls + 1);
+	if (!batch->evt_sq) {
+		ProbeBatch_free(batch);
+		return 1;
+	}
+
+	// Queue the batch behind any others, so older batches are probed first
+	pthread_mutex_lock(&pool->lock);
+	ProbeBatch **link = &pool->head;
+	while (*link) {
+		link = &(*link)->next;
+	}
+	*link = batch;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "audio/out/backend.h"
+#include "config/settings.h"
+#include "meta_cache.h"
+#include "ui/event_queue.h"
+
+#include <stddef.h>
+
+// A pool of threads probing tracks (opening them and reading their metadata, see Track_new()) in parallel,
+// so queueing many tracks at once isn't bound by one file's latency after another.
+// Probed tracks are sent to the main thread as mpl_TRACK_PROBED events, in the order their URLs were given.
+typedef struct ProbePool ProbePool;
+
+// Allocate a new ProbePool, whose tracks are probed for playback with *ab and *settings.
+// Tracks are looked up in (and added to) *cache, unless it's NULL. The cache must outlive the pool.
+ProbePool *ProbePool_new(AudioBackend *ab, const Settings *settings, MetaCache *cache);
+// Stop probing, dropping any tracks not yet sent, then join and free a ProbePool
+void ProbePool_free(ProbePool *pool);
+
+// Probe the n_urls tracks at urls in the background, sending each playable one to *eq as soon as it
+// (and every track before it) has been probed. Tracks that can't be played are skipped.
+// URLs are copied, so the caller keeps ownership of urls.
+// Returns 0 on success, nonzero on error
+// WARN: This routine MUST be called on the main thread (see EventQueue_connect()).
+int ProbePool_probe(ProbePool *pool, EventQueue *eq, const char *const *urls, size_t n_urls);
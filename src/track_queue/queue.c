@@ -45,6 +45,37 @@ static void keep_playback_state(TrackQueue *q) {
 	EventSubQueue_send(q->evt_sq, &evt, false);
 }
 
+// Get the max # of bytes a single track's buffers may use.
+// At most two tracks have buffers at once (the current track and the one being prebuffered),
+// so each gets half of at_buffer_budget_mb. A track's AudioBuffer then fits as many seconds of its PCM format as it can.
+static size_t Queue_track_budget(const TrackQueue *q) {
+	return ((size_t)q->settings->at_buffer_budget_mb << 20) / 2;
+}
+
+// Get the # of ms of audio to prebuffer the next track with
+static uint32_t Queue_prebuf_ms(const TrackQueue *q) {
+	return (q->settings->at_buffer_ahead * 1000) / 10; // FIXME implement an at_prebuffer setting
+}
+
+// Tell the FilePrefetcher to hold the files of the queue_prefetch_tracks tracks after the current one
+// NOTE: q->lock must be held
+static void Queue_update_prefetch(TrackQueue *q) {
+	if (!q->file_prefetcher) {
+		return;
+	}
+	const char *urls[q->settings->queue_prefetch_tracks];
+	size_t n_urls = 0;
+	for (TrackQueueNode *node = q->cur->next; node != q->head && n_urls < q->settings->queue_prefetch_tracks; node = node->next) {
+		urls[n_urls++] = node->track->url;
+	}
+	FilePrefetcher_want(q->file_prefetcher, urls, n_urls);
+}
+
+// Get a reference to the contents of t's file for Track_open(), if the FilePrefetcher holds them
+static AudioFileData *Queue_prefetched(TrackQueue *q, const Track *t) {
+	return q->file_prefetcher && !t->open ? FilePrefetcher_get(q->file_prefetcher, t->url) : NULL;
+}
+
 // Initialize an empty queue
 int TrackQueue_init(TrackQueue *q, const Settings *settings, EventQueue *eq) {
 	memset(q, 0, sizeof(TrackQueue));
@@ -72,6 +103,17 @@ int TrackQueue_init(TrackQueue *q, const Settings *settings, EventQueue *eq) {
 	q->buffer_thread = BufferThread_new();
 	q->prebuffer_thread = BufferThread_new();
 
+	// Track buffers recycle their memory through this, so switching tracks doesn't have to allocate it.
+	// Its idle blocks count against the buffer budget too
+	q->buffer_pool = AudioBufferPool_new((size_t)settings->at_buffer_budget_mb << 20);
+	CHECK_ALLOC(q->buffer_pool, 1);
+
+	// Whole files of upcoming tracks are read into memory, so switching to them never waits on storage
+	if (settings->queue_prefetch_tracks > 0) {
+		q->file_prefetcher = FilePrefetcher_new((size_t)settings->queue_prefetch_mb << 20);
+		CHECK_ALLOC(q->file_prefetcher, 1);
+	}
+
 	q->settings = settings;
 
 	return 0;
@@ -89,6 +131,10 @@ void TrackQueue_deinit(TrackQueue *q) {
 		TrackQueue_disconnect_audio(q);
 	}
 	TrackQueue_clear(q);
+	AudioBufferPool_free(q->buffer_pool);
+	if (q->file_prefetcher) {
+		FilePrefetcher_free(q->file_prefetcher);
+	}
 
 	pthread_mutex_unlock(&q->lock);
 	pthread_mutex_destroy(&q->lock);
@@ -142,6 +188,7 @@ int TrackQueue_append(TrackQueue *q, Track *t) {
 	node->prev->next = node;
 	node->next->prev = node;
 	q->tail = node;
+	Queue_update_prefetch(q);
 
 	int status = 0;
 	if (q->cur == q->head) {
@@ -165,6 +212,7 @@ int TrackQueue_prepend(TrackQueue *q, Track *t) {
 	node->prev->next = node;
 	node->next->prev = node;
 	q->head->next = node;
+	Queue_update_prefetch(q);
 
 	int status = 0;
 	if (q->cur == q->head) {
@@ -196,6 +244,7 @@ int TrackQueue_insert(TrackQueue *q, Track *t, bool before) {
 		node->prev->next = node;
 		node->next->prev = node;
 	}
+	Queue_update_prefetch(q);
 
 	int status = 0;
 	if (q->cur == q->head) {
@@ -227,23 +276,39 @@ int TrackQueue_clear(TrackQueue *q) {
 int TrackQueue_select(TrackQueue *q, TrackQueueNode *node) {
 	pthread_mutex_lock(&q->lock);
 
-	// Set the current track in the queue
-	TrackQueueNode *old = q->cur;
-	q->cur = node;
-	if (old->track && old->track != q->prebuf->track && old->track != q->cur->track) {
-		// Free buffers associated with the old track
-		AudioTrack_deinit_buffers(&old->track->audio);
+	// Take the track's file if it's been prefetched, before the FilePrefetcher moves on to the tracks after it
+	AudioFileData *file_data = Queue_prefetched(q, node->track);
+
+	// Open the track's demuxer + decoder, which are only kept open within the playback window.
+	// On failure, the current track stays as it was
+	enum AudioTrack_ERR open_err = Track_open(node->track, file_data);
+	if (open_err != AudioTrack_OK) {
+		LOG(Verbosity_NORMAL, "Failed to open track %s: %s\n", node->track->url, AudioTrack_ERR_name(open_err));
+		pthread_mutex_unlock(&q->lock);
+		return 1;
 	}
-	
-	// Buffer track audio on the main BufferThread
 	if (!node->track->audio.buffer) {
-		enum AudioTrack_ERR err = AudioTrack_init_buffers(&node->track->audio, q->settings);
+		enum AudioTrack_ERR err = AudioTrack_init_buffers(&node->track->audio, q->settings, Queue_track_budget(q), q->buffer_pool);
 		if (err != AudioTrack_OK) {
 			LOG(Verbosity_NORMAL, "Failed to initialize AudioTrack buffers for track %s: %s\n", node->track->url, AudioTrack_ERR_name(err));
+			// Close the track again (freeing whatever buffers it got) unless it was already in the playback window
+			if (node->track != q->cur->track && node->track != q->prebuf->track) {
+				Track_close(node->track);
+			}
 			pthread_mutex_unlock(&q->lock);
 			return 1;
 		}
 	}
+
+	// Set the current track in the queue
+	TrackQueueNode *old = q->cur;
+	q->cur = node;
+	// The old track leaves the playback window unless it's being prebuffered (or reselected)
+	Track *old_track = old->track && old->track != q->prebuf->track && old->track != q->cur->track ? old->track : NULL;
+
+	Queue_update_prefetch(q);
+
+	// Buffer track audio on the main BufferThread
 	// CRIT: If prebuffering is happening on the prebuf thread, STOP IT BEFORE WE'RE ALLOWED TO TOUCH THE TRACK BUFFERS!
 	if (BufferThread_cur_track(q->prebuffer_thread) == &node->track->audio) {
 		BufferThread_stop_prebuf(q->prebuffer_thread);
@@ -254,6 +319,11 @@ int TrackQueue_select(TrackQueue *q, TrackQueueNode *node) {
 	// Prepare track to start playback on a new audio stream
 	int status = AudioBackend_prepare(q->backend, &node->track->audio);
 
+	// Nothing is buffering or playing the old track anymore, so close it along with its buffers
+	if (old_track) {
+		Track_close(old_track);
+	}
+
 	pthread_mutex_unlock(&q->lock);
 	return status;
 }
@@ -276,13 +346,19 @@ int TrackQueue_preselect(TrackQueue *q, TrackQueueNode *node) {
 		if (BufferThread_cur_track(q->prebuffer_thread) == &old->track->audio) {
 			BufferThread_stop_prebuf(q->prebuffer_thread);
 		}
-		AudioTrack_deinit_buffers(&old->track->audio);
+		Track_close(old->track);
 	}
 
-	// Initialize track buffers
+	// Open the track and initialize its buffers
 	Track *tr = node->track;
+	enum AudioTrack_ERR open_err = Track_open(tr, Queue_prefetched(q, tr));
+	if (open_err != AudioTrack_OK) {
+		LOG(Verbosity_NORMAL, "Failed to open track %s: %s\n", tr->url, AudioTrack_ERR_name(open_err));
+		pthread_mutex_unlock(&q->lock);
+		return 1;
+	}
 	if (!tr->audio.buffer) {
-		enum AudioTrack_ERR err = AudioTrack_init_buffers(&tr->audio, q->settings);
+		enum AudioTrack_ERR err = AudioTrack_init_buffers(&tr->audio, q->settings, Queue_track_budget(q), q->buffer_pool);
 		if (err != AudioTrack_OK) {
 			LOG(Verbosity_NORMAL, "Failed to initialize AudioTrack buffers for track %s: %s\n", node->track->url, AudioTrack_ERR_name(err));
 			pthread_mutex_unlock(&q->lock);
@@ -292,8 +368,7 @@ int TrackQueue_preselect(TrackQueue *q, TrackQueueNode *node) {
 
 	// Start prebuffering
 	BufferThread *prebuf_thread = BufferThread_is_avail(q->buffer_thread) ? q->buffer_thread : q->prebuffer_thread; // If the current (playing) track has finished buffering, we can use the main BufferThread to prebuffer
-	const uint32_t prebuf_ms = (q->settings->at_buffer_ahead * 1000) / 10; // FIXME implement an at_prebuffer setting
-	int status = BufferThread_start_prebuf(prebuf_thread, &tr->audio, prebuf_ms);
+	int status = BufferThread_start_prebuf(prebuf_thread, &tr->audio, Queue_prebuf_ms(q));
 	if (status != 0) {
 		LOG(Verbosity_VERBOSE, "Failed to start prebuffering for track %s\n", node->track->url);
 		pthread_mutex_unlock(&q->lock);
@@ -369,19 +444,66 @@ int TrackQueue_play(TrackQueue *q, bool pause) {
 // NOTE: This function does NOT release these locks. That is left up to the caller.
 //
 // This is its own function so this logic can be called from both [Queue_seek] and [Queue_seek_snap]
-static int Queue_seek_inner(TrackQueue *q, int32_t offset, enum AudioSeek from, AudioTrack *cur_audio) {
-	if (from != AudioSeek_Relative) {
-		LOG(Verbosity_NORMAL, "Warning: only AudioSeek_Relative is currently supported\n");
+static int Queue_seek_inner(TrackQueue *q, int64_t offset, enum AudioSeek from, AudioTrack *cur_audio) {
+	AudioBuffer *buf = cur_audio->buffer;
+	const int64_t frame_size = buf->frame_size;
+
+	// Resolve our target as a byte position from track start
+	int64_t target;
+	switch (from) {
+	case AudioSeek_Start:
+		target = offset;
+		break;
+	case AudioSeek_Relative:
+		target = AudioBuffer_n_read(buf) + offset;
+		break;
+	case AudioSeek_End:
+		// Without a duration, there's no end to seek relative to
+		if (cur_audio->duration_timecode == 0) {
+			LOG(Verbosity_NORMAL, "Can't seek from the end of a track of unknown duration\n");
+			return 1;
+		}
+		target = cur_audio->duration_timecode * frame_size + offset;
+		break;
+	default:
 		return 1;
 	}
-
-	// Try to seek in-buffer
-	{
-		enum AudioBuffer_ERR ab_err;
-		if (ab_err = AudioBuffer_seek(cur_audio->buffer, offset, from), ab_err != AudioBuffer_OK) {
-			LOG(Verbosity_NORMAL, "In-buffer seek failed (%s), bailing out\n", AudioBuffer_ERR_name(ab_err));
+	const int64_t end = cur_audio->duration_timecode * frame_size;
+	if (target < 0) {
+		target = 0;
+	} else if (end > 0 && target > end) {
+		target = end;
+	}
+	target -= target % frame_size;
+
+	// Try to seek in-buffer, falling back to seeking the demuxer when the target isn't buffered
+	enum AudioBuffer_ERR ab_err = AudioBuffer_seek(buf, target, AudioSeek_Start);
+	if (ab_err != AudioBuffer_OK) {
+		LOG(Verbosity_DEBUG, "In-buffer seek failed (%s), seeking demuxer\n", AudioBuffer_ERR_name(ab_err));
+		enum AudioTrack_ERR at_err = AudioTrack_seek(cur_audio, target / frame_size);
+		if (at_err != AudioTrack_OK) {
+			LOG(Verbosity_NORMAL, "Seek failed (%s)\n", AudioTrack_ERR_name(at_err));
 			return 1;
 		}
+
+		// Decode enough to refill the AudioBackend right away.
+		// The BufferThread is locked, so we're the only ones decoding.
+		at_err = AudioTrack_buffer_ms(cur_audio, AudioSeek_Relative, q->settings->ab_buffer_ms);
+		if (at_err != AudioTrack_OK && at_err != AudioTrack_EOF) {
+			LOG(Verbosity_NORMAL, "Failed to buffer after seek (%s)\n", AudioTrack_ERR_name(at_err));
+		}
+
+		// The BufferThread may have already finished buffering this track (or moved on to prebuffering the next one),
+		// so make sure it resumes buffering from our new position.
+		// Prebuffering the next track carries on on the prebuffer thread.
+		if (q->playback_state != Queue_STOPPED && BufferThread_cur_track(q->buffer_thread) != cur_audio) {
+			AudioTrack *prebuf_audio = q->prebuf != q->head && BufferThread_is_prebuf(q->buffer_thread)
+				&& BufferThread_cur_track(q->buffer_thread) == &q->prebuf->track->audio ? &q->prebuf->track->audio : NULL;
+			BufferThread_start(q->buffer_thread, cur_audio);
+			if (prebuf_audio && BufferThread_start_prebuf(q->prebuffer_thread, prebuf_audio, Queue_prebuf_ms(q)) != 0) {
+				LOG(Verbosity_VERBOSE, "Failed to resume prebuffering for track %s\n", q->prebuf->track->url);
+			}
+		}
 	}
 	// Apply seek with audio backend
 	AudioBackend_seek(q->backend);
@@ -391,7 +513,7 @@ static int Queue_seek_inner(TrackQueue *q, int32_t offset, enum AudioSeek from,
 	Event evt = {
 		.event_type = mpl_TIMECODE,
 		.body_size = sizeof(EventBody_Timecode),
-		.body_inline = cur_audio->buffer->n_read / cur_audio->buffer->frame_size
+		.body_inline = AudioBuffer_n_read(cur_audio->buffer) / cur_audio->buffer->frame_size
 	};
 	EventSubQueue_send(q->evt_sq, &evt, false);
 
@@ -409,8 +531,8 @@ int TrackQueue_seek(TrackQueue *q, int32_t offset_ms, enum AudioSeek from) {
 	}
 
 	// Convert offset into bytes
-	const int32_t offset_ms_abs = offset_ms < 0 ? -offset_ms : offset_ms;
-	const int32_t offset = AudioPCM_buffer_size(&cur_audio->buf_pcm, offset_ms_abs) * (offset_ms < 0 ? -1 : 1);
+	// NOTE: we go through frames in 64 bits so seeks deep into long tracks don't overflow
+	const int64_t offset = (int64_t)offset_ms * cur_audio->buf_pcm.sample_rate / 1000 * cur_audio->buffer->frame_size;
 
 	// Pause buffering so we can adjust the buffer's write index
 	BufferThread_lock(q->buffer_thread);
@@ -449,7 +571,7 @@ int TrackQueue_seek_snap(TrackQueue *q, int32_t offset_ms) {
 	int32_t offset = offset_scalar * (offset_ms < 0 ? -1 : 1);
 
 	// Compute seek snap alignment so we get a projected n_read value that's an even multiple of offset_scalar
-	const ssize_t n_read = cur_audio->buffer->n_read,
+	const ssize_t n_read = AudioBuffer_n_read(cur_audio->buffer),
 				frame_size = cur_audio->buffer->frame_size,
 				sample_rate = cur_audio->buf_pcm.sample_rate;
 	const ssize_t fps = frame_size * sample_rate; // frames per second
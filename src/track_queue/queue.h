@@ -6,6 +6,7 @@
 #include "state.h"
 #include "track.h"
 #include "buffer_thread.h"
+#include "file_prefetch.h"
 #include "ui/event_queue.h"
 #include "ui/fmt.h"
 
@@ -26,6 +27,8 @@ typedef struct TrackQueue {
 
 	BufferThread *buffer_thread;
 	BufferThread *prebuffer_thread;
+	AudioBufferPool *buffer_pool; // Recycles AudioBuffer memory between the tracks being played/prebuffered
+	FilePrefetcher *file_prefetcher; // Holds the files of the tracks after the current one in memory, or NULL if disabled
 
 	AudioBackend *backend;
 	EventSubQueue *evt_sq;
@@ -73,7 +76,10 @@ int TrackQueue_preselect(TrackQueue *q, TrackQueueNode *node);
 // Play or pause the currently selected track.
 int	TrackQueue_play(TrackQueue *q, bool pause);
 // Seek within the currently playing track.
-// Handles necessary locks as well as buffer + decoding context updates
+// offset_ms is relative to track start for [AudioSeek_Start], the current position for [AudioSeek_Relative],
+// and track end for [AudioSeek_End]. Targets outside the track are clamped to its start or end.
+// Handles necessary locks as well as buffer + decoding context updates.
+// Seeks to anything not held in the track's AudioBuffer are done by seeking the demuxer.
 int TrackQueue_seek(TrackQueue *q, int32_t offset_ms, enum AudioSeek from);
 // Seek within the current track, snapping to the nearest multiple of offset_ms.
 // [AudioSeek_Relative] is always used as `from`.
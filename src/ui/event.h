@@ -14,6 +14,7 @@
 	VARIANT(mpl_PLAYBACK_STATE) \
 	VARIANT(mpl_TRACK_META) \
 	VARIANT(mpl_TRACK_END) \
+	VARIANT(mpl_TRACK_PROBED) \
 	VARIANT(mpl_SHELL_OPEN) \
 	VARIANT(mpl_SHELL_CLOSE) \
 	VARIANT(mpl_SHELL_HISTORY_PREV) \
@@ -54,3 +55,6 @@ typedef TrackMeta EventBody_TrackMeta;
 
 // Current playback state
 typedef enum Queue_PLAYBACK_STATE EventBody_PlaybackState;
+
+// A track probed by a ProbePool, ready to be queued. The receiver takes ownership of it.
+typedef struct Track *EventBody_TrackProbed;
@@ -63,7 +63,7 @@ static void deinit(void *ud) {
 /* Mainloop for CLI */
 
 // Update track timecode and duration
-static void refresh_timecode(EventBody_Timecode timecode, const AudioTrack *audio, const Settings *settings, TermIOThread *thr);
+static void refresh_timecode(EventBody_Timecode timecode, const Track *track, const Settings *settings, TermIOThread *thr);
 
 static enum UserInterface_ERR mainloop(void * ctx__,
 		EventQueue *evt_queue, TrackQueue *track_queue, Config *config) {
@@ -141,7 +141,7 @@ static enum UserInterface_ERR mainloop(void * ctx__,
 			break;
 
 		case mpl_TIMECODE:
-			refresh_timecode(evt.body_inline, &TrackQueue_cur_track(track_queue)->audio, &config->settings, ctx->io_thread);
+			refresh_timecode(evt.body_inline, TrackQueue_cur_track(track_queue), &config->settings, ctx->io_thread);
 			break;
 	
 		case mpl_TRACK_META:
@@ -163,6 +163,22 @@ static enum UserInterface_ERR mainloop(void * ctx__,
 			}
 			break;
 
+		case mpl_TRACK_PROBED:
+			{
+				// Queue tracks as they're probed, starting playback as soon as the first one is ready
+				EventBody_TrackProbed probed = evt.body;
+				const bool first = TrackQueue_cur_track(track_queue) == NULL;
+				if (TrackQueue_append(track_queue, probed) != 0) {
+					LOG(Verbosity_NORMAL, "Failed to queue track %s\n", probed->url);
+					break;
+				}
+				if (first) {
+					TrackMeta_fmt(&probed->meta, &FMT_CLI);
+					TrackQueue_play(track_queue, 0);
+				}
+			}
+			break;
+
 		case mpl_SHELL_OPEN:
 			TermIOThread_post_event(ctx->io_thread, TermIO_CHANGE_MODE, InputMode_SHELL);
 			break;
@@ -185,15 +201,16 @@ static enum UserInterface_ERR mainloop(void * ctx__,
 }
 
 static void refresh_timecode(EventBody_Timecode timecode,
-		const AudioTrack *audio, const Settings *settings,
+		const Track *track, const Settings *settings,
 		TermIOThread *thr) {
-	const AudioPCM pcm = audio->buf_pcm;
+	// Use the track's cached audio info, which (unlike track->audio) is valid whether or not the track is open
+	const AudioPCM pcm = track->pcm;
 	const bool show_ms = settings->ui_timecode_ms;
 
 	static char timecode_buf[255];
 	static char duration_buf[255];
 	fmt_timecode(timecode_buf, sizeof(timecode_buf), timecode, &pcm, show_ms);
-	fmt_timecode(duration_buf, sizeof(duration_buf), audio->duration_timecode, &pcm, show_ms);
+	fmt_timecode(duration_buf, sizeof(duration_buf), track->duration, &pcm, show_ms);
 
 	TermIOThread_post_event2(thr, TermIO_TIMECODE, timecode_buf, duration_buf);
 }
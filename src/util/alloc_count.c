@@ -0,0 +1,90 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "alloc_count.h"
+#include "log.h"
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define ALLOC_COUNT_SANITIZER
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#define ALLOC_COUNT_SANITIZER
+#endif
+#endif
+
+static _Thread_local uint64_t n_allocs;
+
+#ifdef ALLOC_COUNT_SANITIZER
+// From <sanitizer/allocator_interface.h>, which isn't always installed along with the sanitizer runtimes
+int __sanitizer_install_malloc_and_free_hooks(void (*malloc_hook)(const volatile void *, size_t), void (*free_hook)(const volatile void *));
+
+static void AllocCount_malloc_hook(const volatile void *ptr, size_t size) {
+	n_allocs++;
+}
+
+static void AllocCount_free_hook(const volatile void *ptr) {
+}
+
+void AllocCount_init(void) {
+	if (!__sanitizer_install_malloc_and_free_hooks(AllocCount_malloc_hook, AllocCount_free_hook)) {
+		LOG(Verbosity_NORMAL, "Couldn't hook the sanitizer's allocator, heap allocations won't be counted\n");
+	}
+}
+#elif defined(__GLIBC__)
+// Our definitions take the place of glibc's for the whole process (libav* included), and hand off to glibc's own
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+
+void *malloc(size_t size) {
+	n_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	n_allocs++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	n_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t align, size_t size) {
+	n_allocs++;
+	return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+	n_allocs++;
+	return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) {
+	if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+		return EINVAL;
+	}
+	n_allocs++;
+	void *mem = __libc_memalign(align, size);
+	if (!mem) {
+		return ENOMEM;
+	}
+	*ptr = mem;
+	return 0;
+}
+
+void AllocCount_init(void) {
+}
+#else
+void AllocCount_init(void) {
+	LOG(Verbosity_NORMAL, "Heap allocations can't be counted on this platform\n");
+}
+#endif
+
+uint64_t AllocCount_thread(void) {
+	return n_allocs;
+}
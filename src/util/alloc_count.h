@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// Counts heap allocations (malloc() and friends, including those made inside libav*) per thread,
+// so hot paths can be checked for allocating. Only built with MPL_MEM_DEBUG.
+// Sanitized builds (i.e debug builds) count through the sanitizer's allocator hooks, others by wrapping glibc's allocator.
+// Anywhere else, nothing is counted.
+
+// Start counting. Call once at startup, before any threads are created
+void AllocCount_init(void);
+// Get the # of heap allocations the calling thread has made so far
+uint64_t AllocCount_thread(void);
@@ -1,8 +1,14 @@
 #include "path.h"
 #include "error.h"
 
+#include "log.h"
+
 #include <string.h>
 #include <stdlib.h>
+#ifndef __WIN32
+#include <errno.h>
+#include <sys/stat.h>
+#endif
 
 
 int path_join(char **dst, size_t *dst_len,
@@ -38,3 +44,50 @@ int path_join(char **dst, size_t *dst_len,
 
 	return 0;
 }
+
+int path_cache(char **dst, size_t *dst_len,
+		const char **subpaths, const size_t n_subpaths) {
+	const char *parts[n_subpaths + 3];
+	size_t n_parts = 0;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (cache_home && cache_home[0]) {
+		parts[n_parts++] = cache_home;
+	} else if (home && home[0]) {
+		parts[n_parts++] = home;
+		parts[n_parts++] = ".cache";
+	} else {
+		return 1;
+	}
+	parts[n_parts++] = "mpl";
+	for (size_t i = 0; i < n_subpaths; i++) {
+		parts[n_parts++] = subpaths[i];
+	}
+
+	return path_join(dst, dst_len, parts, n_parts);
+}
+
+const char *path_from_url(const char *url) {
+	static const char PROTO_FILE[] = "file:";
+	if (strncmp(url, PROTO_FILE, sizeof(PROTO_FILE) - 1) == 0) {
+		return url + sizeof(PROTO_FILE) - 1;
+	}
+	// Any other protocol (i.e http://) isn't local
+	const char *sep = strchr(url, ':');
+	if (sep && sep - url > 1 && strncmp(sep, "://", 3) == 0) {
+		return NULL;
+	}
+	return url;
+}
+
+void path_mkdir_parents(char *path) {
+#ifndef __WIN32
+	for (char *sep = strchr(path + 1, '/'); sep; sep = strchr(sep + 1, '/')) {
+		*sep = '\0';
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			LOG(Verbosity_DEBUG, "Failed to create directory %s\n", path);
+		}
+		*sep = '/';
+	}
+#endif
+}
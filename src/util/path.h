@@ -7,3 +7,16 @@
 // Returns 0 on success, 1 if no paths were provided.
 int path_join(char **dst, size_t *dst_len,
 		const char **subpaths, const size_t n_subpaths);
+
+// Join subpaths under mpl's cache directory ($XDG_CACHE_HOME/mpl, falling back to $HOME/.cache/mpl), as path_join() does.
+// Returns 0 on success, 1 if there's no cache directory.
+int path_cache(char **dst, size_t *dst_len,
+		const char **subpaths, const size_t n_subpaths);
+
+// Get the local filesystem path a libav* URL refers to (without its file: protocol prefix),
+// or NULL if the URL isn't a local file. The result points into url.
+const char *path_from_url(const char *url);
+
+// Create every missing parent directory of *path.
+// *path is modified in the process, but restored before returning.
+void path_mkdir_parents(char *path);
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // syscall()
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+struct URing {
+	int fd;
+	unsigned n_in_flight; // Reads queued or submitted, and not yet reaped
+
+	// Submission queue, shared with the kernel
+	void *sq_map;
+	size_t sq_map_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned sq_queued_tail; // Tail including reads queued since the last submit
+
+	// Completion queue, shared with the kernel (and possibly mapped along with the submission queue)
+	void *cq_map;
+	size_t cq_map_size;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+URing *URing_new(unsigned depth) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	const int fd = syscall(__NR_io_uring_setup, depth, &params);
+	if (fd < 0) {
+		return NULL;
+	}
+	URing *ur = malloc(sizeof(URing));
+	if (!ur) {
+		close(fd);
+		return NULL;
+	}
+	memset(ur, 0, sizeof(URing));
+	ur->fd = fd;
+	ur->sq_map = ur->cq_map = ur->sqes = MAP_FAILED;
+
+	// IORING_OP_READ arrived along with IORING_FEAT_RW_CUR_POS (Linux 5.6)
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		URing_free(ur);
+		return NULL;
+	}
+
+	ur->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ur->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		ur->sq_map_size = ur->cq_map_size = ur->sq_map_size > ur->cq_map_size ? ur->sq_map_size : ur->cq_map_size;
+	}
+	ur->sq_map = mmap(NULL, ur->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ur->sq_map == MAP_FAILED) {
+		URing_free(ur);
+		return NULL;
+	}
+	ur->cq_map = single_mmap
+		? ur->sq_map
+		: mmap(NULL, ur->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ur->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ur->cq_map == MAP_FAILED || ur->sqes == MAP_FAILED) {
+		URing_free(ur);
+		return NULL;
+	}
+
+	unsigned char *const sq = ur->sq_map;
+	ur->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ur->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ur->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ur->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ur->sq_entries = params.sq_entries;
+	ur->sq_queued_tail = *ur->sq_tail;
+
+	unsigned char *const cq = ur->cq_map;
+	ur->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ur->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return ur;
+}
+
+void URing_free(URing *ur) {
+	if (ur->sqes != MAP_FAILED) {
+		munmap(ur->sqes, ur->sqes_size);
+	}
+	if (ur->cq_map != MAP_FAILED && ur->cq_map != ur->sq_map) {
+		munmap(ur->cq_map, ur->cq_map_size);
+	}
+	if (ur->sq_map != MAP_FAILED) {
+		munmap(ur->sq_map, ur->sq_map_size);
+	}
+	close(ur->fd);
+	free(ur);
+}
+
+int URing_prep_read(URing *ur, int fd, void *buf, unsigned n, int64_t offset, uint64_t tag) {
+	// Never have more in flight than the completion queue is guaranteed to hold (it's at least as big as the submission queue)
+	if (ur->n_in_flight >= ur->sq_entries) {
+		return 1;
+	}
+
+	const unsigned index = ur->sq_queued_tail & *ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = n;
+	sqe->off = offset;
+	sqe->user_data = tag;
+	ur->sq_array[index] = index;
+
+	ur->sq_queued_tail++;
+	ur->n_in_flight++;
+	return 0;
+}
+
+int URing_submit(URing *ur, unsigned min_complete) {
+	// Publish the queued entries, then tell the kernel about any it hasn't consumed yet
+	__atomic_store_n(ur->sq_tail, ur->sq_queued_tail, __ATOMIC_RELEASE);
+	const unsigned n_submit = ur->sq_queued_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	if (n_submit == 0 && min_complete == 0) {
+		return 0;
+	}
+	const int status = syscall(__NR_io_uring_enter, ur->fd, n_submit, min_complete,
+			min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	return status < 0 ? -errno : 0;
+}
+
+bool URing_reap(URing *ur, uint64_t *tag, int32_t *res) {
+	const unsigned head = *ur->cq_head;
+	if (head == __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+	*tag = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ur->cq_head, head + 1, __ATOMIC_RELEASE);
+	ur->n_in_flight--;
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A minimal io_uring queue for reading files asynchronously, set up through the kernel's own interface (linux/io_uring.h).
+// Reads are queued with URing_prep_read(), handed to the kernel in one system call with URing_submit(),
+// and their results collected with URing_reap(). A URing is meant to be used by one thread.
+typedef struct URing URing;
+
+// Set up a URing for up to depth reads in flight at once.
+// Returns NULL if io_uring isn't available (i.e the kernel is too old, or it's disabled by sysctl/seccomp)
+URing *URing_new(unsigned depth);
+// Tear down a URing. NOTE: reads still in flight may complete into their buffers until they're reaped, so reap them first
+void URing_free(URing *ur);
+
+// Queue a read of n bytes of fd at offset into *buf, to be identified by tag when it completes.
+// Returns nonzero if depth reads are already queued or in flight
+int URing_prep_read(URing *ur, int fd, void *buf, unsigned n, int64_t offset, uint64_t tag);
+// Submit the queued reads, then wait until at least min_complete reads have completed.
+// Returns 0 on success, or a negative errno
+int URing_submit(URing *ur, unsigned min_complete);
+// Take a completed read, setting *tag to its tag and *res to the # of bytes read (or a negative errno).
+// Returns false if no reads have completed
+bool URing_reap(URing *ur, uint64_t *tag, int32_t *res);